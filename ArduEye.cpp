@@ -32,7 +32,32 @@
 */
 
 #include <ArduEye.h>
-#include <SPI.h>
+#include <ArduEyeBus.h>
+
+ArduEye *ArduEye::_RdySensors[MAX_SENSORS];
+
+// dataset table, in the order of the DS_IDX_ indexes
+#define DS_DESCRIPTOR(Id, Display, Name, Cache, Rows, Cols, Divisor) \
+    {Id, Display, Name, Cache, Rows, Cols, Divisor},
+static const DSDescriptor DataSets[MAX_DATASETS] PROGMEM = {
+    ARDUEYE_DATASETS(DS_DESCRIPTOR)
+};
+
+// every dataset id must have a slot in DataSetSlots
+#define DS_CHECK(Id, Display, Name, Cache, Rows, Cols, Divisor) \
+    typedef char DS_CHECK_##Id[((Id) >= DS_ID_FIRST && (Id) < DS_ID_FIRST + 2 * DS_ID_SLOTS && \
+                                !((Id) & 1)) ? 1 : -1];
+ARDUEYE_DATASETS(DS_CHECK)
+
+// index in the dataset table of the ids DS_ID_FIRST, DS_ID_FIRST + 2 ... (see getDataIndex), 
+// one DS_SLOT per slot
+typedef char DS_CHECK_SLOTS[(DS_ID_SLOTS == 8) ? 1 : -1];
+#define DS_SLOT(Slot) (signed char)DataSetIndex<DS_ID_FIRST + 2 * (Slot)>::Value
+static const signed char DataSetSlots[DS_ID_SLOTS] PROGMEM = {
+    DS_SLOT(0), DS_SLOT(1), DS_SLOT(2), DS_SLOT(3), 
+    DS_SLOT(4), DS_SLOT(5), DS_SLOT(6), DS_SLOT(7)
+};
+
 /*---------------------------------------------------
  ArduEye: Constructor
  ---------------------------------------------------*/
@@ -42,20 +67,93 @@ ArduEye::ArduEye()
 	_SerialTx = false;
 	_SerialMonitorMode = false;
     _NumActiveSets = 0;
-    _InSIdx = _InBufIdx = 0;
-    _ESCReceived = false;
-    _BufEnd = 0;
+    _RxHead = _RxTail = 0;
+    _RxOverflow = _RxEsc = false;
+    _CmdLen = NULL_CHAR;
     Toggle = Toggle2 = false;
 	_TemporaryDataSet = NULL_CHAR;
+    _SPIOpen = false;
+    _FrameRequest = _FrameOpen = false;
+    _ChunkRequest = false;
+    _HeldCmdSize = NULL_CHAR;
+    _TxLen = _TxIdx = 0;
+    _TxDataLen = _TxDataIdx = 0;
+    _TxPacket = _HeldPing = false;
+    _HeldAcks = 0;
+    _AcqState = ACQ_IDLE;
+    _AckReceived = false;
+    _LinkLost = _LinkBack = false;
+    _LinkTime = 0;
+    _CreditMode = false;
+    _Credit = _CreditWindow = 0;
+    _TxPendLen = _TxPendIdx = 0;
+    _Compression = _CmpMode = COMPRESS_NONE;
+    _HeaderChange = false;
+    _CRCMode = _SerialCRC = CRC_NONE;
+    _NextCRC = NULL_CHAR;
+    _NextCRCAcked = false;
+    _CRCErrors = _TxCRC = 0;
+    _TxROI = false;
+    _FrameBudget = 0;
+    _BudgetLeft = 0;
+    _NumFrameSets = 0;
+    _ReceiveBuffer = 0;
+    _FrameBuf = 0;
+    _FrameBufSize = _BufSets = _BufUsed = 0;
+    _AcqBuffered = false;
+    _RdyInterrupt = false;
+    _FramePending = _RdyLevel = false;
+    _FrameTime = _FrameInterval = _IntervalAvg = _JitterAvg = 0;
+    _FrameCount = 0;
+    _Bus = 0;
+    _SensorID = NULL_CHAR;
+    _RxQueue = this;
+    resetProfile();
 }
 
 /*---------------------------------------------------
- begin : Initialize ArduEye Interface
+ begin : Initialize ArduEye Interface with the default
+ link settings (115200 baud, SPI_CLOCK_DIV8, SPI_MODE3)
  Input:     RdyPin: DataReady pin (default is 9 on ArduEye)
             CSPin: ChipSelect pin  (default is 10 on ArduEye)
  ---------------------------------------------------*/
 void ArduEye::begin(int RdyPin, int CSPin)
 {
+    begin(RdyPin, CSPin, ArduEyeConfig());
+}
+
+/*---------------------------------------------------
+ begin : Initialize ArduEye Interface
+ Input:     RdyPin: DataReady pin (default is 9 on ArduEye)
+            CSPin: ChipSelect pin  (default is 10 on ArduEye)
+            Config: serial baud rate, SPI clock divider and mode
+ ---------------------------------------------------*/
+void ArduEye::begin(int RdyPin, int CSPin, const ArduEyeConfig &Config)
+{
+    // the receive buffer only holds a packet within a blocking call (poll() 
+    // stages its chunks from _PollBuf), so the sensors not on a bus can 
+    // share one (left out of sketches using ArduEyeBus)
+    static char ReceiveBuffer[MAX_SPI_PCKT_SIZE];
+    
+    _ReceiveBuffer = ReceiveBuffer;
+    beginSensor(RdyPin, CSPin);
+    
+    // initialize serial and spi links
+    setLinkConfig(Config);
+}
+
+/*---------------------------------------------------
+ beginSensor: set up the pins and the dataset table, without
+ touching the serial and SPI links (see ArduEyeBus::attach)
+ Input:     RdyPin: DataReady pin
+            CSPin: ChipSelect pin
+ ---------------------------------------------------*/
+void ArduEye::beginSensor(int RdyPin, int CSPin)
+{
+    int i;
+    DSRecord *DS;
+    const DSDescriptor *Desc;
+    
     // initalize the  data ready and chip select pins:
 	_dataReadyPin = RdyPin;
 	_chipSelectPin = CSPin;
@@ -70,34 +168,105 @@ void ArduEye::begin(int RdyPin, int CSPin)
     
     pinMode(7, OUTPUT);
     digitalWrite(7,LOW);
-	
+
+    // dataset settings from the dataset table
+    for(i = 0; i < MAX_DATASETS; i++)
+    {
+        DS = &_DS[i];
+        Desc = &DataSets[i];
+        DS->DSID = (char)pgm_read_byte(&Desc->DSID);
+        DS->DisplayType = (char)pgm_read_byte(&Desc->DisplayType);
+        DS->name = (char *)pgm_read_word(&Desc->Name);
+        DS->CacheHeader = pgm_read_byte(&Desc->CacheHeader);
+        DS->LastSize = pgm_read_byte(&Desc->Rows) * pgm_read_byte(&Desc->Cols);
+        DS->Divisor = pgm_read_byte(&Desc->Divisor);
+    }
+}
+
+/*---------------------------------------------------
+ setLinkConfig: (re)initialize the serial and SPI links.  The
+ UI and the ArduEye firmware must use matching settings
+ Input:   Config: serial baud rate, SPI clock divider and mode
+ ---------------------------------------------------*/
+void ArduEye::setLinkConfig(const ArduEyeConfig &Config)
+{
+    _Config = Config;
+    
     // initialize serial link
-	Serial.begin(115200);
+	Serial.begin(_Config.Baud);
     	
 	// initialize spi link
-	  SPI.setClockDivider(SPI_CLOCK_DIV8);
-	  SPI.setDataMode(SPI_MODE3);
-	  SPI.setBitOrder(MSBFIRST);
-	  SPI.begin();
-
-    // set default display types for datasets
-	  _DS[0].DSID = ARDUEYE_ID_RAW;
-      _DS[0].DisplayType = DISPLAY_GRAYSCALE_IMAGE;
-    
-	  _DS[1].DSID = ARDUEYE_ID_OF;
-      _DS[1].DisplayType = DISPLAY_CHARTS;
-	  
-	  _DS[2].DSID = ARDUEYE_ID_FPS;
-      _DS[2].DisplayType = DISPLAY_TEXT;
-      char * name = "FPS Sensor: ";
-     _DS[2].name = name;
-    
-      _DS[3].DSID = ARDUEYE_ID_CMD;
-      _DS[3].DisplayType = DISPLAY_DUMP;
-        
-      _DS[4].DSID = ARDUEYE_ID_MAXES;
-      _DS[4].DisplayType = DISPLAY_POINTS;
-	 	
+    SPI.setClockDivider(_Config.SPIDivider);
+    SPI.setDataMode(_Config.SPIMode);
+    SPI.setBitOrder(MSBFIRST);
+    SPI.begin();
+}
+
+/*---------------------------------------------------
+ linkTest: measure the throughput of both links with the
+ current settings, e.g. to try several ArduEyeConfigs at 
+ startup and keep the fastest stable one.  The serial test 
+ writes LINK_TEST_BYTES zero bytes outside of any packet 
+ (ignored by the UI).  The SPI test waits for a frame, reads
+ the header of DataSet twice and its payload once, then ends
+ the frame.  The dataset should be active and large (RAW)
+ Input:   DataSet: dataset read for the SPI test
+          SPIRate: set to SPI payload bytes/sec (0 on failure)
+          SerialRate: set to serial bytes/sec
+ returns: true if a frame was read and both headers matched
+          and gave a valid size
+ ---------------------------------------------------*/
+boolean ArduEye::linkTest(char DataSet, unsigned long *SPIRate, unsigned long *SerialRate)
+{
+    unsigned char Header[FULL_HEAD_SIZE], Check[FULL_HEAD_SIZE];
+    char Fill[TX_BLOCK_SIZE];
+    unsigned long Start, Time;
+    int i, InSize;
+    
+    *SPIRate = *SerialRate = 0;
+    if(spiBusy())
+        return false;
+    
+    // serial link
+    for(i = 0; i < TX_BLOCK_SIZE; i++)
+        Fill[i] = 0;
+    Start = micros();
+    for(i = 0; i < LINK_TEST_BYTES; i += TX_BLOCK_SIZE)
+        Serial.write((const uint8_t *)Fill, TX_BLOCK_SIZE);
+    Time = micros() - Start;
+    if(Time > 0)
+        *SerialRate = (unsigned long)LINK_TEST_BYTES * 1000000 / Time;
+    
+    // spi link, wait for a frame
+    Start = millis();
+    while(!dataRdy())
+        if(millis() - Start > LINK_TEST_TIMEOUT)
+            return false;
+    
+    InSize = readHeader(DataSet, Header);
+    readHeader(DataSet, Check);
+    for(i = 0; i < FULL_HEAD_SIZE; i++)
+        if(Header[i] != Check[i])
+            InSize = 0;
+    
+    if(InSize > 0)
+    {
+        Start = micros();
+        requestPacket(SOD_CHAR, DataSet);
+        for(i = 0; i + MAX_SPI_PCKT_SIZE < InSize; i += MAX_SPI_PCKT_SIZE)
+            readChunk(DataSet, i, _ReceiveBuffer, MAX_SPI_PCKT_SIZE);
+        readChunk(DataSet, i, _ReceiveBuffer, InSize - i);
+        closePacket();
+        Time = micros() - Start;
+        if(Time > 0)
+            *SPIRate = (unsigned long)InSize * 1000000 / Time;
+    }
+    
+    // let the ArduEye start the next frame
+    _FramePending = false;
+    sendCommand(END_FRAME);
+    
+    return InSize > 0;
 }
 
 /*---------------------------------------------------
@@ -109,24 +278,26 @@ void ArduEye::begin(int RdyPin, int CSPin)
  ---------------------------------------------------*/
 void ArduEye::startDataStream(char DataSet)
 {
-  int i;  
-  sendCommand((char)DISPLAY_CMD, &DataSet, 1);
+  int i = getDataIndex(DataSet);  
+  // ARDUEYE_ID_PROFILE is made by the library, not the ArduEye
+  if(DataSet != ARDUEYE_ID_PROFILE)
+    sendCommand((char)DISPLAY_CMD, &DataSet, 1);
   
   // update DSRecord
-  for (i = 0; i < MAX_DATASETS; i++)
+  if(i >= 0)
   {   
-    if(_DS[i].DSID == DataSet)
+    // if dataset is not already active, add to _ActiveSets list
+    // and increase NumActiveSets count
+    if(_DS[i].Active == false)
     {
-        // if dataset is not already active, add to _ActiveSets list
-        // and increase NumActiveSets count
-        if(_DS[i].Active == false)
-        {
-            _ActiveSets[_NumActiveSets] = i;
-            _NumActiveSets++;
-        }
-        _DS[i].Active = true;
-      break;
+        _ActiveSets[_NumActiveSets] = i;
+        _NumActiveSets++;
+        // read on the next frame, with a new header
+        _DS[i].Skipped = _DS[i].Divisor - 1;
+        _DS[i].HeaderReads = 0;
+        _DS[i].SentDisplay = -1;
     }
+    _DS[i].Active = true;
   }
     // Print Dataset status to serial monitor if active
     if(_SerialTx && _SerialMonitorMode)
@@ -145,25 +316,19 @@ void ArduEye::startDataStream(char DataSet)
  ---------------------------------------------------*/
 void ArduEye::stopDataStream(char DataSet)
 {  
-    int i, m;  
-    sendCommand((char)STOP_CMD, &DataSet, 1);
-    
-      // update DSRecord
-      for (i = 0; i < MAX_DATASETS; i++)
-      {   
-        // set active flag to false  
-        if(_DS[i].DSID == DataSet)
-        {
-          _DS[i].Active = false;
-          break;
-        }
-      }
+    int i, m, DSIdx = getDataIndex(DataSet);  
+    if(DataSet != ARDUEYE_ID_PROFILE)
+        sendCommand((char)STOP_CMD, &DataSet, 1);
+    
+    // update DSRecord: set active flag to false
+    if(DSIdx >= 0)
+        _DS[DSIdx].Active = false;
   
     // remove the datset from the ActiveSets list and 
     // decrease the NumActiveSets count
     for(i = 0; i < _NumActiveSets; i++)
     {
-        if(_DS[_ActiveSets[i]].DSID == DataSet)
+        if(_ActiveSets[i] == DSIdx)
         {
             for(m = i; m < _NumActiveSets-1; m++)
                 _ActiveSets[m] = _ActiveSets[m+1];
@@ -186,489 +351,2061 @@ void ArduEye::stopDataStream(char DataSet)
  checkBufferFull: check that serial buffer is not full, 
  so it is OK to send data.  When serial buffer is not full, the
  UI will send an OK_CHAR in response to receiveing a GO_CHAR
- from the ARDUINO
+ from the ARDUINO.  If none arrives within ACK_TIMEOUT the 
+ link is lost (see linkLost) and serial output stops
  returns: true if Buffer is clear and false if buffer is full
  This function is called by getData() and getDataset()
  ---------------------------------------------------*/
 boolean ArduEye::checkBufferFull()
 {
-    int BytesReceived = 0;
-    int Count = 0, CycleCount = 0;
-    char inByte;
-	unsigned long elapsedTime = millis();
+	unsigned long Start = millis();
+    
+    // in credit mode flushSerial waits for credit instead
+    if(_CreditMode)
+        return true;
+    PROF_START(Wait);
+    
+    // send GO_CHAR
+    Serial.print((char)ESC_CHAR);
+    Serial.print((char)GO_CHAR);
     
-    // Send GO_CHAR up to 50 times if no ACK is received
-    while((Count < 50) && (CycleCount < 10))
+    // process incoming bytes until an ACK_CHAR is received (checkUIData returns true)
+    while(!checkUIData())
     {
-        // send GO_CHAR
-        Serial.print((char)ESC_CHAR);
-        Serial.print((char)GO_CHAR);
-        
-        // wait until serial data is received
-        while(BytesReceived == 0)
-		{
-            BytesReceived = Serial.available();
-			if(millis() - elapsedTime > ACK_TIMEOUT)
-			{
-				// if no ack has be received, turn off serial communication and return false
-				_SerialTx = false;
-				return false;
-			}
-		}
-    
-        // process incoming bytes (checkUIData returns true if an ACK_CHAR is received)
-        // return true if ACK_CHAR received
-        if(checkUIData())
-            return true; 
-        
-        // if no ACK_CHAR received, send GO_CHAR again
-        BytesReceived = 0;
-        Count++;
-        
-        if(Count == 50)
+        if(millis() - Start > ACK_TIMEOUT)
         {
-            Count = 0;
-            CycleCount++;
-            delay(1000);
+            PROF_TIME(PROF_WAIT_US, Wait);
+            linkLost();
+            return false;
         }
     }
-   
-    // if no ack has be received, turn off serial communication and return false
+    PROF_TIME(PROF_WAIT_US, Wait);
+    return true;
+}
+
+/*---------------------------------------------------
+ linkLost: the UI did not acknowledge a ping or grant 
+ credit within ACK_TIMEOUT.  Serial output stops and the 
+ staged output is dropped, so getData() and poll() run at 
+ full speed without the UI.  checkUIData() pings the UI 
+ every ACK_TIMEOUT, once it answers output resumes from the
+ next frame.  linkStatus() returns LINK_LOST meanwhile
+ ---------------------------------------------------*/
+void ArduEye::linkLost()
+{
+    PROF_ADD(PROF_ACK_TIMEOUTS, 1);
+    // the staged output is lost
+    PROF_ADD(PROF_DROPPED, 1);
     _SerialTx = false;
-    digitalWrite(6,HIGH); // for debugging
-    return false;
-        
+    _LinkLost = true;
+    _LinkTime = millis();
+    
+    _TxLen = _TxIdx = 0;
+    _TxDataLen = _TxDataIdx = 0;
+    _TxPendLen = _TxPendIdx = 0;
+    _TxPacket = false;
 }
 
 /*---------------------------------------------------
- getData: get data from active datasets
- this command can be run each loop to acquire data
- dataRdy() must be checked before running getData()
+ linkStatus: state of the serial link to the UI
+ returns: LINK_OFF if serial transmit is off, LINK_LOST if
+          the UI stopped answering, LINK_WAITING while 
+          waiting for an ACK_CHAR or credit, else LINK_OK
  ---------------------------------------------------*/
-void ArduEye::getData()
+int ArduEye::linkStatus()
 {
-	int i, k, InSize, Rows, Cols, c, Idx, remaining;
-	unsigned char Header[FULL_HEAD_SIZE];
-   //Header: 1 byte DataId, 2 byte rows, 2 byte cols
-      
-    // loop through active datasets
-    for (k = 0; k < _NumActiveSets; k++)
+    if(_LinkLost)
+        return LINK_LOST;
+    if(!_SerialTx)
+        return LINK_OFF;
+    if(_AcqState == ACQ_ACK || (_AcqState == ACQ_FLUSH && _CreditMode && _Credit <= 0))
+        return LINK_WAITING;
+    return LINK_OK;
+}
+
+/*---------------------------------------------------
+ requestPacket: request a header (SOH_CHAR) or dataset
+ (SOD_CHAR) from the ArduEye.  Chip select is left low and
+ the SPI link in read mode, so the caller reads the reply
+ and then calls closePacket()
+ Input:   Type: SOH_CHAR or SOD_CHAR
+          DataSet: dataset ID
+ ---------------------------------------------------*/
+void ArduEye::requestPacket(char Type, char DataSet)
+{
+    // write mode, request packet, read mode
+    byte Request[10] = {ESC_CHAR, WRITE_CHAR, 
+                        ESC_CHAR, START_PCKT, (byte)Type, (byte)DataSet, ESC_CHAR, END_PCKT,
+                        ESC_CHAR, READ_CHAR};
+    
+#ifdef ARDUEYE_PROFILE
+    // made by the library (see readChunk)
+    if(DataSet == ARDUEYE_ID_PROFILE)
+        return;
+#endif
+    digitalWrite(_chipSelectPin, LOW);
+    _SPIOpen = true;
+    spiTransferBlock(Request, 0, sizeof(Request));
+    // delay to allow the ArduEye time to prepare the reply
+    delayMicroseconds(1);
+}
+
+/*---------------------------------------------------
+ closePacket: raise chip select at the end of a read and
+ send any command that was held while the read was open, 
+ by this sensor or by the others on its bus
+ ---------------------------------------------------*/
+void ArduEye::closePacket()
+{
+    digitalWrite(_chipSelectPin, HIGH);
+    _SPIOpen = _FrameOpen = false;
+    
+    if(_Bus)
+        _Bus->releaseCmd();
+    else
+        sendHeldCmd();
+}
+
+/*---------------------------------------------------
+ spiBusy: chip select of this sensor, or of another sensor
+ on its ArduEyeBus, is low for a read (between calls to 
+ poll(), see setChunkRequest).  Other requests would be 
+ read as part of the reply, so commands are held and the
+ blocking reads return without reading
+ ---------------------------------------------------*/
+boolean ArduEye::spiBusy()
+{
+    if(_Bus)
+        return _Bus->busy();
+    return _SPIOpen;
+}
+
+// send the command held by sendCommand() once the SPI bus is free
+void ArduEye::sendHeldCmd()
+{
+    int Size = _HeldCmdSize;
+    
+    if(Size < 0 || spiBusy())
+        return;
+    _HeldCmdSize = NULL_CHAR;
+    sendCommand(_HeldCmd[0], _HeldCmd + 1, Size);
+}
+
+/*---------------------------------------------------
+ readHeader: read the header of a dataset
+ Input:   DataSet: dataset ID
+          Header: array of FULL_HEAD_SIZE bytes for the header
+ returns: dataset size (rows * cols)
+ ---------------------------------------------------*/
+int ArduEye::readHeader(char DataSet, unsigned char *Header)
+{
+    boolean Valid;
+    
+#ifdef ARDUEYE_PROFILE
+    if(DataSet == ARDUEYE_ID_PROFILE)
+        return profileHeader(Header);
+#endif
+    PROF_DATASET(getDataIndex(DataSet));
+    PROF_START(Start);
+    
+    for(int Retry = 0; Retry <= CRC_RETRIES; Retry++)
     {
-      	// read data packet header
-        digitalWrite(_chipSelectPin, LOW);
-        // set SPI link to Write mode
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(WRITE_CHAR);
-        
-        // request dataset header
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(START_PCKT);
-        SPI.transfer(SOH_CHAR); 
-        SPI.transfer(_DS[_ActiveSets[k]].DSID);
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(END_PCKT);
+        //Header: 1 byte DataId, 2 byte rows, 2 byte cols
+        requestPacket(SOH_CHAR, DataSet);
+        spiTransferBlock(0, Header, FULL_HEAD_SIZE);
+        Valid = (_CRCMode == CRC_NONE) || 
+            checkCRC(crcUpdate(CRC_INIT, (char *)Header, FULL_HEAD_SIZE, _CRCMode));
+        closePacket();
+        PROF_ADD(PROF_SPI_BYTES, FULL_HEAD_SIZE + _CRCMode / 8);
         
-        // set spi link to read mode
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(READ_CHAR);
-        //delay to allow ArduEye time to prepare header
-        delayMicroseconds(1);
-        // read header data
-        for (i = 0; i < FULL_HEAD_SIZE; i++)
-          Header[i] = SPI.transfer(0x00);
-        digitalWrite(_chipSelectPin, HIGH);
-        
-        // assign row and colum data for serial display      
-        Rows = (Header[1] << 8) + Header[2];
-        Cols = (Header[3] << 8) + Header[4];
-        // assign incoming dataset size
-        InSize = Rows * Cols;
-       
-		// write header data to serial monitor or UI if active
-		if(_SerialTx)
+        if(Valid)
         {
-           if(_SerialMonitorMode)
-           { 
-               // serial monitor mode is used primarily for debugging
-               // print header info in a legible way
-               if(checkBufferFull())
-               {
-                   Serial.print(_DS[_ActiveSets[k]].DSID); Serial.print(" ");
-                   Serial.print(Rows, DEC); Serial.print(" ");
-                   Serial.print(Cols, DEC);Serial.print(" ");
-                   Serial.print(_DS[_ActiveSets[k]].DisplayType); Serial.print(" ");
-                   Serial.println(" ");
-               }
-            }
-            else
+            PROF_TIME(PROF_HEADER_US, Start);
+            return ((Header[1] << 8) + Header[2]) * ((Header[3] << 8) + Header[4]);
+        }
+        _CRCErrors++;
+    }
+    PROF_TIME(PROF_HEADER_US, Start);
+    
+    // no valid header, the dataset is skipped as one with an incorrect size
+    Header[1] = Header[2] = Header[3] = Header[4] = 0;
+    return 0;
+}
+
+/*---------------------------------------------------
+ requestResume: request the payload of a dataset from byte
+ Idx on, after a chunk failed its CRC check.  The reply is
+ read with readChunk(), then closePacket() is called
+ Input:   DataSet: dataset ID
+          Idx: offset in the payload, a multiple of CRC_CHUNK_SIZE
+ ---------------------------------------------------*/
+void ArduEye::requestResume(char DataSet, int Idx)
+{
+    // write mode, request packet, read mode
+    byte Request[12] = {ESC_CHAR, WRITE_CHAR, 
+                        ESC_CHAR, START_PCKT, SOC_CHAR, (byte)DataSet, (byte)(Idx >> 8), (byte)(Idx & 0xFF), 
+                        ESC_CHAR, END_PCKT, ESC_CHAR, READ_CHAR};
+    
+#ifdef ARDUEYE_PROFILE
+    // made by the library (see readChunk)
+    if(DataSet == ARDUEYE_ID_PROFILE)
+        return;
+#endif
+    digitalWrite(_chipSelectPin, LOW);
+    _SPIOpen = true;
+    spiTransferBlock(Request, 0, sizeof(Request));
+    // delay to allow the ArduEye time to prepare the reply
+    delayMicroseconds(1);
+}
+
+/*---------------------------------------------------
+ readChunk: read payload bytes from the open request.  With
+ CRC trailers on (see setCRC) the payload comes in chunks of
+ CRC_CHUNK_SIZE bytes, each followed by its CRC.  A chunk
+ that fails the check is requested again, from its start, 
+ up to CRC_RETRIES times and the rest of the payload follows
+ it.  This ends a frame request: the caller closes the 
+ resumed request and the next datasets are requested alone
+ Input:   DataSet: dataset ID
+          Idx: offset of Data in the payload, a multiple of
+            CRC_CHUNK_SIZE
+          Data: array for the bytes
+          Size: bytes to read, a multiple of CRC_CHUNK_SIZE
+            unless the read ends the payload
+ returns: false if a chunk was still corrupt after the retries
+          (it is kept as read)
+ ---------------------------------------------------*/
+boolean ArduEye::readChunk(char DataSet, int Idx, char *Data, int Size)
+{
+    int n, Retry;
+    boolean Valid = true;
+    
+#ifdef ARDUEYE_PROFILE
+    if(DataSet == ARDUEYE_ID_PROFILE)
+    {
+        profileData(Idx, Data, Size);
+        return true;
+    }
+#endif
+    PROF_DATASET(getDataIndex(DataSet));
+    PROF_START(Start);
+    
+    if(_CRCMode == CRC_NONE)
+    {
+        spiTransferBlock(0, (byte *)Data, Size);
+        PROF_ADD(PROF_SPI_BYTES, Size);
+        PROF_TIME(PROF_PAYLOAD_US, Start);
+        return true;
+    }
+    
+    for(; Size > 0; Idx += n, Data += n, Size -= n)
+    {
+        n = (Size < CRC_CHUNK_SIZE) ? Size : CRC_CHUNK_SIZE;
+        for(Retry = 0; ; Retry++)
+        {
+            spiTransferBlock(0, (byte *)Data, n);
+            PROF_ADD(PROF_SPI_BYTES, n + _CRCMode / 8);
+            if(checkCRC(crcUpdate(CRC_INIT, Data, n, _CRCMode)))
+                break;
+            _CRCErrors++;
+            if(Retry == CRC_RETRIES)
             {
-                // Send header data packet to UI if buffer is clear
-                if(checkBufferFull())
-                {
-                    Serial.print((char)ESC_CHAR);
-                    Serial.print((char)START_PCKT);  // send start of packet byte
-                    for(i = 0; i < FULL_HEAD_SIZE; i++) // send header packet data
-                    {
-                        Serial.print(Header[i]);
-                        if(Header[i] == ESC_CHAR)
-                            Serial.print(Header[i]);
-                    }
-                    Serial.print((char)(_DS[_ActiveSets[k]].DisplayType)); // append display type
-                    Serial.print((char)ESC_CHAR);
-                    Serial.print((char)END_PCKT);  //send end of packet byte   
-                }
+                Valid = false;
+                break;
             }
-         }
-        
-        // abort read if size data is incorrect
-        if(InSize <= 0)
-            break;
-          
-          // send start of packet bytes via serial if _SerialTx is active
-          if(_SerialTx)
-          {
-              if(_SerialMonitorMode) // print to serial monitor mode
-              {
-                  Serial.print(ESC_CHAR);
-                  Serial.print(START_PCKT);
-                  Serial.println(_DS[_ActiveSets[k]].DSID,DEC);
-              }
-              else  // print to UI mode
-              {
-                  Serial.print((char)ESC_CHAR); 
-                  Serial.print((char)START_PCKT); // send start of packet byte
-                  Serial.print((char)(_DS[_ActiveSets[k]].DSID)); // send dataset ID
-                  // text display has a different format to tell UI what to display
-                  if(_DS[_ActiveSets[k]].DisplayType == DISPLAY_TEXT)
-                      Serial.print((char)Cols);
-              }
-          }
-      
-      
-        // read data packet 
-        // set spi link to write mode
-        digitalWrite(_chipSelectPin, LOW);
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(WRITE_CHAR);
-        
-        // request dataset
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(START_PCKT);
-        SPI.transfer(SOD_CHAR); 
-        SPI.transfer(_DS[_ActiveSets[k]].DSID);
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(END_PCKT);
-        
-        // set spi link to read mode
-        SPI.transfer(ESC_CHAR);
-        SPI.transfer(READ_CHAR);
-        // delay to allow the ArduEye time to prepare the dataset
-        delayMicroseconds(1);
-        Idx = 0;
-        // read MAX_SPI_PCKT_SIZE bytes of data at a time (max size defined in ArduEye.h)
-        while(Idx + MAX_SPI_PCKT_SIZE < InSize)
+            closePacket();
+            requestResume(DataSet, Idx);
+        }
+    }
+    PROF_TIME(PROF_PAYLOAD_US, Start);
+    return Valid;
+}
+
+/*---------------------------------------------------
+ checkCRC: read the CRC trailer of a header or chunk
+ Input:   CRC: CRC computed over the bytes read
+ returns: true if the trailer matches
+ ---------------------------------------------------*/
+boolean ArduEye::checkCRC(unsigned long CRC)
+{
+    byte Trailer[4];
+    int i, Size = _CRCMode / 8;
+    
+    spiTransferBlock(0, Trailer, Size);
+    for(i = 0; i < Size; i++)
+        if(Trailer[i] != (byte)(CRC >> (8 * (Size - 1 - i))))
+            return false;
+    return true;
+}
+
+// CRC-16/CCITT (0x1021) and reflected CRC-32 (0xEDB88320) for 4 bits at a time
+static const unsigned int CRC16Table[16] PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+static const unsigned long CRC32Table[16] PROGMEM = {
+    0x00000000UL, 0x1DB71064UL, 0x3B6E20C8UL, 0x26D930ACUL, 
+    0x76DC4190UL, 0x6B6B51F4UL, 0x4DB26158UL, 0x5005713CUL, 
+    0xEDB88320UL, 0xF00F9344UL, 0xD6D6A3E8UL, 0xCB61B38CUL, 
+    0x9B64C2B0UL, 0x86D3D2D4UL, 0xA00AE278UL, 0xBDBDF21CUL
+};
+
+/*---------------------------------------------------
+ crcUpdate: continue a CRC over Size bytes, with 16 entry
+ tables in flash instead of 256 entry ones
+ Input:   CRC: CRC so far, CRC_INIT for a new one
+          Data, Size: bytes to add
+          Width: CRC_16 or CRC_32
+ returns: the CRC (the low 16 bits for CRC_16)
+ ---------------------------------------------------*/
+unsigned long ArduEye::crcUpdate(unsigned long CRC, const char *Data, int Size, char Width)
+{
+    unsigned char b;
+    unsigned int C16 = CRC;
+    
+    if(Width == CRC_16)
+    {
+        while(Size--)
         {
-            for(i = 0; i < MAX_SPI_PCKT_SIZE; i++)
-                _ReceiveBuffer[i] = SPI.transfer(0x00);
-            
-            // send data via serial
-            if (_SerialTx)
-            { 
-                for (i = 0; i < MAX_SPI_PCKT_SIZE; i++)
-                {
-                    Serial.print(_ReceiveBuffer[i]);
-                    //duplicate the data character if it is equal to the ESC_CHAR
-                    if(_ReceiveBuffer[i] == ESC_CHAR)
-                        Serial.print(_ReceiveBuffer[i]);
-                }
-                // print a spacer for legibility in serial monitor mode
-                if(_SerialMonitorMode)
-                    Serial.println(" ");
-                
-                // check that serial buffer is clear every two packets
-                if(Idx % (MAX_SPI_PCKT_SIZE * 2) == 0)
-                {     
-                    if(!checkBufferFull())
-                        break;
-                }
-            }
-            Idx+= MAX_SPI_PCKT_SIZE;
-          }
-          remaining = InSize - Idx;
-        
-          // get remaining data
-          if(remaining)
-          {
-              for(i = 0; i < remaining; i++)
-                  _ReceiveBuffer[i] = SPI.transfer(0x00);
-              
-              // send data via serial
-              if (_SerialTx)
-              {   	
-                  for (i = 0; i < remaining; i++)
-                  {
-                      Serial.print(_ReceiveBuffer[i]);
-                      //duplicate the data character if it is equal to the ESC_CHAR
-                      if(_ReceiveBuffer[i] == ESC_CHAR)
-                          Serial.print(_ReceiveBuffer[i]);
-                  }
-                  if(_DS[_ActiveSets[k]].DisplayType == DISPLAY_TEXT)
-                      Serial.print(_DS[_ActiveSets[k]].name);
-                  // print a spacer for legibility in serial monitor mode
-                  if(_SerialMonitorMode)
-                      Serial.println(" ");
-                  
-              } 
-          }
-          digitalWrite(_chipSelectPin, HIGH);
-          
-        // send end of Packet bye
-          if(_SerialTx)
-          {
-              if(_SerialMonitorMode) //send to serial monitor
-              {
-                  Serial.print((char)ESC_CHAR);
-                  Serial.println((char)END_PCKT);
-              }
-              else     //send to UI
-              {
-                  Serial.print((char)ESC_CHAR);
-                  Serial.print((char)END_PCKT);
-              }
-                  
-          }        
-  } 
-  // when all datasets are received, call end of frame  
-  endFrame();
-  
-  // clear TemporaryDatSet if active
-  if(_TemporaryDataSet >= 0)
-  {	
-	stopDataStream(_TemporaryDataSet);
-	_TemporaryDataSet = NULL_CHAR;
-	}
-	
+            b = *Data++;
+            C16 = (C16 << 4) ^ pgm_read_word(&CRC16Table[((C16 >> 12) ^ (b >> 4)) & 0x0F]);
+            C16 = (C16 << 4) ^ pgm_read_word(&CRC16Table[((C16 >> 12) ^ b) & 0x0F]);
+        }
+        return C16 & 0xFFFF;
+    }
+    
+    while(Size--)
+    {
+        b = *Data++;
+        CRC = (CRC >> 4) ^ pgm_read_dword(&CRC32Table[(CRC ^ b) & 0x0F]);
+        CRC = (CRC >> 4) ^ pgm_read_dword(&CRC32Table[(CRC ^ (b >> 4)) & 0x0F]);
+    }
+    return CRC;
 }
+
 /*---------------------------------------------------
- getDisplayType : read display type from DSRecord struct
- Input:   Dataset: Any of the values defined as "Dataset IDs"
-           in the Sensor header file (ie ArmSensor.h)
+ setCRC: ask the ArduEye to add CRC trailers to headers and
+ payloads (CMD_CRC).  Headers or chunks that fail the 
+ check are requested again, a header that is still corrupt
+ after CRC_RETRIES skips the frame as an incorrect size 
+ would.  The ArduEye firmware must support CMD_CRC and 
+ SOC_CHAR requests.  Trailers are expected from the next
+ request after the command is sent
+ Input:   Width: CRC_NONE, CRC_16 or CRC_32
  ---------------------------------------------------*/
-int ArduEye::getDataIndex(char DataSet)
+void ArduEye::setCRC(char Width)
 {
-    for(int i = 0; i < MAX_DATASETS; i++)
+    sendCommand(CMD_CRC, &Width, 1);
+}
+
+// headers and chunks that failed their CRC check
+unsigned long ArduEye::crcErrors()
+{
+    return _CRCErrors;
+}
+
+/*---------------------------------------------------
+ requestFrame: request the headers and payloads of all the
+ datasets in _FrameSets at once.  The ArduEye replies with
+ the header and then the payload of each dataset, in order,
+ so a frame is read with one chip select and one request
+ instead of two per dataset.  The caller reads the reply with
+ readFrameHeader() and readPayload(), then calls closePacket()
+ ---------------------------------------------------*/
+void ArduEye::requestFrame()
+{
+    byte Request[MAX_DATASETS + 10];
+    int k, Size = 0;
+    
+    // write mode, request packet, read mode
+    Request[Size++] = ESC_CHAR;
+    Request[Size++] = WRITE_CHAR;
+    Request[Size++] = ESC_CHAR;
+    Request[Size++] = START_PCKT;
+    Request[Size++] = SOF_CHAR;
+    Request[Size++] = 0;
+    // datasets made by the library are not requested (readFrameHeader skips them)
+    for(k = 0; k < _NumFrameSets; k++)
+        if(_DS[_FrameSets[k]].DSID != ARDUEYE_ID_PROFILE)
+        {
+            Request[Size++] = _DS[_FrameSets[k]].DSID;
+            Request[5]++;
+        }
+    Request[Size++] = ESC_CHAR;
+    Request[Size++] = END_PCKT;
+    Request[Size++] = ESC_CHAR;
+    Request[Size++] = READ_CHAR;
+    
+    digitalWrite(_chipSelectPin, LOW);
+    _SPIOpen = _FrameOpen = true;
+    spiTransferBlock(Request, 0, Size);
+    // delay to allow the ArduEye time to prepare the reply
+    delayMicroseconds(1);
+}
+
+/*---------------------------------------------------
+ readFrameHeader: read the header of the next dataset of a
+ frame request, or request it on its own if no frame request
+ is open.  A header for another dataset means the ArduEye 
+ did not answer the frame request: frame requests are turned
+ off and the header is requested on its own.  RAW and OF 
+ only change size with resolution commands, so once 
+ HEADER_CACHE_READS reads in a row have returned the same
+ header it is used without requesting it, until a
+ resolution command is sent (see invalidateHeaders)
+ Input:   DSIdx: index of the dataset settings in _DS
+          Header: array of FULL_HEAD_SIZE bytes for the header
+ returns: dataset size (rows * cols)
+ ---------------------------------------------------*/
+int ArduEye::readFrameHeader(int DSIdx, unsigned char *Header)
+{
+    DSRecord *DS = &_DS[DSIdx];
+    boolean Read = true;
+    int i;
+    
+#ifdef ARDUEYE_PROFILE
+    if(DS->DSID == ARDUEYE_ID_PROFILE)
+        return profileHeader(Header);
+#endif
+    PROF_DATASET(DSIdx);
+    PROF_ADD(PROF_COUNT, 1);
+    
+    if(_FrameOpen)
     {
-        if(_DS[i].DSID == DataSet)
-           return i;
+        PROF_START(Start);
+        spiTransferBlock(0, Header, FULL_HEAD_SIZE);
+        PROF_ADD(PROF_SPI_BYTES, FULL_HEAD_SIZE + _CRCMode / 8);
+        // corrupt header, request it alone
+        if(_CRCMode != CRC_NONE && 
+           !checkCRC(crcUpdate(CRC_INIT, (char *)Header, FULL_HEAD_SIZE, _CRCMode)))
+        {
+            _CRCErrors++;
+            closePacket();
+            Read = false;
+        }
+        else if(Header[0] != (unsigned char)DS->DSID)
+        {
+            closePacket();
+            _FrameRequest = false;
+            Read = false;
+        }
+        PROF_TIME(PROF_HEADER_US, Start);
     }
-           
-    return 0;
+    else
+        Read = false;
+    
+    if(!Read)
+    {
+        if(DS->CacheHeader && DS->HeaderReads >= HEADER_CACHE_READS)
+        {
+            Header[0] = DS->DSID;
+            for(i = 1; i < FULL_HEAD_SIZE; i++)
+                Header[i] = DS->Header[i - 1];
+            return ((Header[1] << 8) + Header[2]) * ((Header[3] << 8) + Header[4]);
+        }
+        readHeader(DS->DSID, Header);
+    }
+    
+    // count the reads in a row that returned the same header
+    for(i = 1; i < FULL_HEAD_SIZE; i++)
+        if(Header[i] != DS->Header[i - 1])
+            break;
+    if(i < FULL_HEAD_SIZE)
+    {
+        for(i = 1; i < FULL_HEAD_SIZE; i++)
+            DS->Header[i - 1] = Header[i];
+        DS->HeaderReads = 1;
+    }
+    else if(DS->HeaderReads < HEADER_CACHE_READS)
+        DS->HeaderReads++;
+    
+    return ((Header[1] << 8) + Header[2]) * ((Header[3] << 8) + Header[4]);
+}
+
+/*---------------------------------------------------
+ invalidateHeaders: request the headers again after a 
+ command that can change the size of the datasets
+ Input:   Cmd: command sent to the ArduEye
+ ---------------------------------------------------*/
+void ArduEye::invalidateHeaders(char Cmd)
+{
+    if(Cmd != CMD_RESOLUTION && Cmd != CMD_OF_RESOLUTION)
+        return;
+    for(int i = 0; i < MAX_DATASETS; i++)
+        _DS[i].HeaderReads = 0;
+}
+
+/*---------------------------------------------------
+ setFrameRequest: read each frame with a single request for
+ all the scheduled datasets (see requestFrame) in getData()
+ and poll().  Off by default, the ArduEye firmware must 
+ support SOF_CHAR requests.  Commands sent while the frame 
+ is read are held until it is finished
+ Input:   Enable: true to use frame requests
+ ---------------------------------------------------*/
+void ArduEye::setFrameRequest(boolean Enable)
+{
+    _FrameRequest = Enable;
+}
+
+/*---------------------------------------------------
+ setChunkRequest: request each POLL_CHUNK_SIZE chunk of a 
+ payload on its own in poll(), the first one with SOD_CHAR
+ and the next ones with a resume request (SOC_CHAR) from 
+ their offset.  Chip select is then raised at the end of 
+ each call instead of staying low until the payload is 
+ read, for a few more request bytes per chunk.  Off by 
+ default, the ArduEye firmware must support SOC_CHAR 
+ requests.  The reply to a frame request is still read 
+ with one chip select (see setFrameRequest)
+ Input:   Enable: true to request each chunk on its own
+ ---------------------------------------------------*/
+void ArduEye::setChunkRequest(boolean Enable)
+{
+    _ChunkRequest = Enable;
 }
+
+/*---------------------------------------------------
+ Serial output staging.  Packets for the UI are staged in
+ _TxBuf and the dataset payload is referenced in place, then
+ flushSerial() sends them, either waiting for the serial
+ port (getData, getDataSet) or only while it is free (poll)
+ ---------------------------------------------------*/
+void ArduEye::stageByte(char Data)
+{
+    if(_TxLen < TX_BUF_SIZE)
+        _TxBuf[_TxLen++] = Data;
+}
+
+// ESC START, then SOS_CHAR sensor_id for a sensor on an ArduEyeBus
+void ArduEye::stagePacketStart()
+{
+    stageByte(ESC_CHAR);
+    stageByte(START_PCKT);
+    _TxPacket = true;
+    _TxCRC = CRC_INIT;
+    if(_SensorID != NULL_CHAR)
+    {
+        stageContent(SOS_CHAR);
+        stageContent(_SensorID);
+    }
+}
+
+// packet content, before ESC_CHAR duplication, is covered by the CRC trailer 
+void ArduEye::stageContent(char Data)
+{
+    if(_SerialCRC != CRC_NONE)
+        _TxCRC = crcUpdate(_TxCRC, &Data, 1, _SerialCRC);
+    stageByte(Data);
+}
+
+// CRC trailer (see CRC_CMD), before ESC END, ESC_CHAR duplicated
+void ArduEye::stageCRC()
+{
+    char Data;
+    int i, Size = _SerialCRC / 8;
+    
+    for(i = Size - 1; i >= 0; i--)
+    {
+        Data = _TxCRC >> (8 * i);
+        stageByte(Data);
+        if(Data == ESC_CHAR)
+            stageByte(Data);
+    }
+    _TxCRC = CRC_INIT;
+}
+
+// CRC trailer and ESC END.  CMD_ACKs and pings held meanwhile follow once it is sent
+void ArduEye::stagePacketEnd()
+{
+    stageCRC();
+    stageByte(ESC_CHAR);
+    stageByte(END_PCKT);
+    _TxPacket = false;
+}
+
+// header packet: ESC START header display_type ESC END
+void ArduEye::stageHeader(int DSIdx, unsigned char *Header)
+{
+    int i;
+    unsigned char Out[FULL_HEAD_SIZE];
+    
+    if(!headerChanged(DSIdx, Header))
+        return;
+    PROF_DATASET(DSIdx);
+    
+    // rows and cols of the region sent to the UI
+    forwardHeader(DSIdx, Header, Out);
+    
+    stagePacketStart();
+    if(_HeaderChange)
+    {
+        stageContent(SOH_CHAR);
+        for(i = 1; i < FULL_HEAD_SIZE; i++)
+            _DS[DSIdx].SentHeader[i - 1] = Out[i];
+        _DS[DSIdx].SentDisplay = _DS[DSIdx].DisplayType;
+    }
+    for(i = 0; i < FULL_HEAD_SIZE; i++)
+    {
+        stageContent(Out[i]);
+        //duplicate the header character if it is equal to the ESC_CHAR
+        if(Out[i] == ESC_CHAR)
+            stageByte(Out[i]);
+    }
+    stageContent(_DS[DSIdx].DisplayType);
+    stagePacketEnd();
+}
+
+/*---------------------------------------------------
+ headerChanged: check if a header has to be sent to the UI.
+ Once the UI has sent HEADER_CMD, a header is only sent when
+ the rows, cols or display type differ from the last one
+ sent for the dataset, and header packets start with 
+ SOH_CHAR so the UI can tell them from data packets
+ Input:   DSIdx: index of the dataset settings in _DS
+          Header: header read from the ArduEye
+ returns: true if the header must be sent
+ ---------------------------------------------------*/
+boolean ArduEye::headerChanged(int DSIdx, unsigned char *Header)
+{
+    unsigned char Out[FULL_HEAD_SIZE];
+    int i;
+    
+    if(!_HeaderChange || _SerialMonitorMode || _DS[DSIdx].SentDisplay != _DS[DSIdx].DisplayType)
+        return true;
+    
+    forwardHeader(DSIdx, Header, Out);
+    for(i = 1; i < FULL_HEAD_SIZE; i++)
+        if(Out[i] != _DS[DSIdx].SentHeader[i - 1])
+            return true;
+    return false;
+}
+
+// start of data packet: ESC START dataset_id (cols for text display)
+// (compression mode for RAW and OF when compression is on)
+void ArduEye::stageDataStart(int DSIdx, unsigned char *Header)
+{
+    DSRecord *DS = &_DS[DSIdx];
+    unsigned char Out[FULL_HEAD_SIZE];
+    int InSize;
+    
+    PROF_DATASET(DSIdx);
+    // size of the region sent to the UI
+    startROI(DSIdx, Header);
+    forwardHeader(DSIdx, Header, Out);
+    InSize = ((Out[1] << 8) + Out[2]) * ((Out[3] << 8) + Out[4]);
+    
+    stagePacketStart();
+    stageContent(DS->DSID);
+    // text display has a different format to tell UI what to display
+    if(DS->DisplayType == DISPLAY_TEXT)
+        stageContent(Out[4]);
+    
+    // set up compression of the payload
+    _CmpMode = COMPRESS_NONE;
+    if(_Compression != COMPRESS_NONE && 
+       (DS->DSID == ARDUEYE_ID_RAW || DS->DSID == ARDUEYE_ID_OF))
+    {
+        _CmpMode = COMPRESS_DELTA;
+        _CmpStore = _CmpRef = 0;
+        if(DS->Ref && InSize <= DS->RefMax)
+        {
+            // previous frame is the reference if it has the same size
+            if(_Compression == COMPRESS_FRAME && DS->RefSize == InSize)
+            {
+                _CmpMode = COMPRESS_FRAME;
+                _CmpRef = DS->Ref;
+            }
+            _CmpStore = DS->Ref;
+        }
+        DS->RefSize = 0;
+        _CmpPrev = _CmpRun = 0;
+        _CmpIdx = 0;
+        stageContent(_CmpMode);
+    }
+}
+
+// end of data packet: (name for text display) (CRC) ESC END
+// (pending zero run when compressing)
+void ArduEye::stageDataEnd(int DSIdx)
+{
+    char *Name = _DS[DSIdx].name;
+    // room left for the CRC trailer, ESC_CHAR duplicated
+    int Reserve = 2 + 2 * (_SerialCRC / 8);
+    
+    _TxROI = false;
+    if(_CmpMode != COMPRESS_NONE)
+    {
+        if(_CmpRun)
+        {
+            stageContent(0);
+            stageContent(_CmpRun);
+            //duplicate the run length if it is equal to the ESC_CHAR
+            if(_CmpRun == ESC_CHAR)
+                stageByte(ESC_CHAR);
+        }
+        // the stored frame is the reference for the next one
+        if(_CmpStore)
+            _DS[DSIdx].RefSize = _CmpIdx;
+        _CmpMode = COMPRESS_NONE;
+    }
+    
+    if(_DS[DSIdx].DisplayType == DISPLAY_TEXT && Name)
+        while(*Name && _TxLen < TX_BUF_SIZE - Reserve)
+            stageContent(*Name++);
+    stagePacketEnd();
+}
+
+// end of frame packet: ESC START END_FRAME (CRC) ESC END
+void ArduEye::stageEndFrame()
+{
+    // counted in the frame only
+    PROF_DATASET(-1);
+    stagePacketStart();
+    stageContent(END_FRAME);
+    stagePacketEnd();
+    
+    // frame boundary: the UI has the CMD_ACK of CRC_CMD, both sides switch now
+    if(_NextCRC != NULL_CHAR && _NextCRCAcked)
+    {
+        _SerialCRC = _NextCRC;
+        _NextCRC = NULL_CHAR;
+    }
+}
+
+// dataset payload, sent with ESC_CHAR duplicated
+void ArduEye::stageData(const char *Buf, int Size)
+{
+    _TxData = Buf;
+    _TxDataLen = Size;
+    _TxDataIdx = 0;
+}
+
+// write Data to Out, duplicated if it is equal to the ESC_CHAR, returns bytes written
+static int escapeByte(char *Out, char Data)
+{
+    Out[0] = Data;
+    if(Data != ESC_CHAR)
+        return 1;
+    Out[1] = ESC_CHAR;
+    return 2;
+}
+
+/*---------------------------------------------------
+ encodeData: encode staged payload into Out in one pass,
+ compressing it if a compression mode is set for the packet
+ and duplicating ESC_CHAR, without splitting the bytes 
+ produced for one payload byte
+ 
+ Compressed payload: each byte is replaced by its difference
+ (mod 256) from the previous byte of the dataset 
+ (COMPRESS_DELTA) or from the same byte of the previous frame
+ (COMPRESS_FRAME).  A run of n zero differences (n = 1..255)
+ is sent as the two bytes 0, n
+ Input:   Out: output block
+          OutSize: free space in Out
+ returns: number of bytes written to Out
+ ---------------------------------------------------*/
+int ArduEye::encodeData(char *Out, int OutSize)
+{
+    int Len = 0, n, i;
+    char Token[6];
+    char Data, Delta = 0;
+    
+    while(_TxDataIdx < _TxDataLen)
+    {
+        // skip bytes outside the region of interest
+        if(_TxROI && !selectROI())
+        {
+            nextROI();
+            _TxDataIdx++;
+            continue;
+        }
+        
+        Data = _TxData[_TxDataIdx];
+        n = 0;
+        if(_CmpMode == COMPRESS_NONE)
+            n = escapeByte(Token, Data);
+        else
+        {
+            Delta = Data - (_CmpRef ? _CmpRef[_CmpIdx] : _CmpPrev);
+            // a non zero difference or a full run ends the current run
+            if((Delta != 0 || _CmpRun == 255) && _CmpRun)
+            {
+                n += escapeByte(Token + n, 0);
+                n += escapeByte(Token + n, _CmpRun);
+            }
+            if(Delta != 0)
+                n += escapeByte(Token + n, Delta);
+        }
+        
+        if(Len + n > OutSize)
+            break;
+        for(i = 0; i < n; i++)
+            Out[Len++] = Token[i];
+        // CRC of the bytes before ESC_CHAR duplication
+        if(_SerialCRC != CRC_NONE)
+            for(i = 0; i < n; i++)
+            {
+                _TxCRC = crcUpdate(_TxCRC, Token + i, 1, _SerialCRC);
+                if(Token[i] == ESC_CHAR)
+                    i++;
+            }
+        
+        if(_CmpMode != COMPRESS_NONE)
+        {
+            if(Delta != 0)
+                _CmpRun = 0;
+            else
+                _CmpRun = (_CmpRun == 255) ? 1 : _CmpRun + 1;
+            _CmpPrev = Data;
+            if(_CmpStore)
+                _CmpStore[_CmpIdx] = Data;
+            _CmpIdx++;
+        }
+        if(_TxROI)
+            nextROI();
+        _TxDataIdx++;
+    }
+    return Len;
+}
+
+/*---------------------------------------------------
+ Region of interest.  setROI() selects a window of a dataset,
+ and every Step-th row and column in it, to be sent to the UI.
+ The header sent to the UI gives the size of the selection, 
+ on board processing (handlers, getDataSet) still gets the 
+ whole dataset
+ ---------------------------------------------------*/
+
+// window of the dataset selected by setROI(), clipped to the dataset size
+// returns true if only part of the dataset is selected
+boolean ArduEye::windowROI(int DSIdx, unsigned char *Header, int *Row, int *Col, int *Rows, int *Cols)
+{
+    DSRecord *DS = &_DS[DSIdx];
+    int InRows = (Header[1] << 8) + Header[2];
+    int InCols = (Header[3] << 8) + Header[4];
+    
+    *Row = (DS->ROIRow < InRows) ? DS->ROIRow : InRows;
+    *Col = (DS->ROICol < InCols) ? DS->ROICol : InCols;
+    *Rows = InRows - *Row;
+    *Cols = InCols - *Col;
+    if(DS->ROIRows > 0 && DS->ROIRows < *Rows)
+        *Rows = DS->ROIRows;
+    if(DS->ROICols > 0 && DS->ROICols < *Cols)
+        *Cols = DS->ROICols;
+    
+    return *Rows < InRows || *Cols < InCols || DS->ROIStep > 1;
+}
+
+// header sent to the UI: Header with the rows and cols of the selection
+void ArduEye::forwardHeader(int DSIdx, unsigned char *Header, unsigned char *Out)
+{
+    int i, Row, Col, Rows, Cols, Step = _DS[DSIdx].ROIStep;
+    
+    for(i = 0; i < FULL_HEAD_SIZE; i++)
+        Out[i] = Header[i];
+    if(windowROI(DSIdx, Header, &Row, &Col, &Rows, &Cols))
+    {
+        Rows = (Rows + Step - 1) / Step;
+        Cols = (Cols + Step - 1) / Step;
+        Out[1] = Rows >> 8;
+        Out[2] = Rows & 0xFF;
+        Out[3] = Cols >> 8;
+        Out[4] = Cols & 0xFF;
+    }
+}
+
+// start selecting the payload of a dataset
+void ArduEye::startROI(int DSIdx, unsigned char *Header)
+{
+    _TxROI = windowROI(DSIdx, Header, &_ROIRow, &_ROICol, &_ROIRows, &_ROICols);
+    _ROIStep = _DS[DSIdx].ROIStep;
+    _TxRow = _TxCol = 0;
+    _TxCols = (Header[3] << 8) + Header[4];
+}
+
+// true if the next payload byte is selected
+boolean ArduEye::selectROI()
+{
+    int Row = _TxRow - _ROIRow;
+    int Col = _TxCol - _ROICol;
+    
+    if(Row < 0 || Row >= _ROIRows || Col < 0 || Col >= _ROICols)
+        return false;
+    return _ROIStep == 1 || (Row % _ROIStep == 0 && Col % _ROIStep == 0);
+}
+
+// move to the next payload byte
+void ArduEye::nextROI()
+{
+    if(++_TxCol >= _TxCols)
+    {
+        _TxCol = 0;
+        _TxRow++;
+    }
+}
+
+/*---------------------------------------------------
+ setROI: select the part of a dataset sent to the UI.  Only
+ the window of Rows x Cols starting at (Row, Col) is sent, 
+ taking every Step-th row and column.  The UI can also set
+ it with ROI_CMD
+ Input:   DataSet: Any of the values defined as "Dataset IDs"
+            in the Sensor header file (ie ArmSensor.h)
+          Row, Col: top left corner of the window
+          Rows, Cols: window size, 0 to go to the edge
+          Step: decimation, 1 to send every pixel
+          setROI(DataSet, 0, 0, 0, 0, 1) sends the whole dataset
+ ---------------------------------------------------*/
+void ArduEye::setROI(char DataSet, int Row, int Col, int Rows, int Cols, int Step)
+{
+    int i = getDataIndex(DataSet);
+    
+    if(i < 0)
+        return;
+    _DS[i].ROIRow = Row;
+    _DS[i].ROICol = Col;
+    _DS[i].ROIRows = Rows;
+    _DS[i].ROICols = Cols;
+    _DS[i].ROIStep = (Step > 0) ? Step : 1;
+}
+
+/*---------------------------------------------------
+ flushSerial: send staged serial output
+ When blocking, staged packet bytes and the encoded payload
+ are assembled in TX_BLOCK_SIZE blocks and each block is sent
+ with a single Serial.write call.  When not blocking, the
+ payload is encoded a few bytes at a time into _TxPend and
+ sent while the serial port is free.  In credit mode each byte
+ sent uses one byte of credit, when credit runs out a blocking
+ flush waits for more and a non blocking flush returns
+ Input:   Block: wait for the serial port if true, otherwise
+          only write while the port can take a byte at once
+ returns: true when all staged output has been sent
+ ---------------------------------------------------*/
+boolean ArduEye::flushSerial(boolean Block)
+{
+#ifdef ARDUEYE_PROFILE
+    // serial forwarding time, without the time spent waiting for credit
+    unsigned long Start = micros(), Wait = _ProfFrame[PROF_WAIT_US];
+    boolean Done = writeSerial(Block);
+    profileAdd(PROF_SERIAL_US, micros() - Start - (_ProfFrame[PROF_WAIT_US] - Wait));
+    return Done;
+#else
+    return writeSerial(Block);
+#endif
+}
+
+// flushSerial without the performance counters
+boolean ArduEye::writeSerial(boolean Block)
+{
+    char Out[TX_BLOCK_SIZE];
+    int Len;
+    
+    if(Block)
+    {
+        while(_TxPendIdx < _TxPendLen || _TxIdx < _TxLen || _TxDataIdx < _TxDataLen)
+        {
+            for(Len = 0; _TxPendIdx < _TxPendLen; Len++)
+                Out[Len] = _TxPend[_TxPendIdx++];
+            for(; _TxIdx < _TxLen && Len < TX_BLOCK_SIZE; Len++)
+                Out[Len] = _TxBuf[_TxIdx++];
+            Len += encodeData(Out + Len, TX_BLOCK_SIZE - Len);
+            // the link was lost, the staged output was dropped
+            if(_CreditMode && !waitCredit(Len))
+                return false;
+            Serial.write((const uint8_t *)Out, Len);
+            PROF_ADD(PROF_SERIAL_BYTES, Len);
+        }
+    }
+    
+    while(_TxIdx < _TxLen)
+    {
+        if(!serialTxReady() || (_CreditMode && !waitCredit(0)))
+            return false;
+        Serial.write(_TxBuf[_TxIdx++]);
+        PROF_ADD(PROF_SERIAL_BYTES, 1);
+    }
+    
+    while(_TxPendIdx < _TxPendLen || _TxDataIdx < _TxDataLen)
+    {
+        // encode more payload (zero runs may give no bytes yet)
+        if(_TxPendIdx >= _TxPendLen)
+        {
+            _TxPendLen = encodeData(_TxPend, TX_PEND_SIZE);
+            _TxPendIdx = 0;
+            continue;
+        }
+        if(!serialTxReady() || (_CreditMode && !waitCredit(0)))
+            return false;
+        Serial.write(_TxPend[_TxPendIdx++]);
+        PROF_ADD(PROF_SERIAL_BYTES, 1);
+    }
+    
+    _TxLen = _TxIdx = 0;
+    _TxDataLen = _TxDataIdx = 0;
+    _TxPendLen = _TxPendIdx = 0;
+    sendHeldControl();
+    return true;
+}
+
+/*---------------------------------------------------
+ sendControl: send ESC Code to the UI (CMD_ACK for a command,
+ GO_CHAR to ping a lost link).  Sent at once between packets,
+ otherwise held until the packet being staged or sent has 
+ gone out, so the code never splits an ESC_CHAR pair or 
+ lands between staged bytes (checkUIData() runs in the 
+ middle of poll() frames and of credit waits)
+ Input:   Code: CMD_ACK or GO_CHAR
+ ---------------------------------------------------*/
+void ArduEye::sendControl(char Code)
+{
+    if(Code == CMD_ACK)
+    {
+        if(_HeldAcks < 255)
+            _HeldAcks++;
+    }
+    else
+        _HeldPing = true;
+    sendHeldControl();
+}
+
+// send the held codes if no packet is open and the staged output has been sent
+void ArduEye::sendHeldControl()
+{
+    if((_TxPacket && _SerialTx) || _TxLen > 0 || _TxDataLen > 0 || _TxPendLen > 0)
+        return;
+    
+    if(_HeldAcks > 0 && _NextCRC != NULL_CHAR)
+        _NextCRCAcked = true;
+    for(; _HeldAcks > 0; _HeldAcks--)
+    {
+        Serial.print((char)ESC_CHAR);
+        Serial.print((char)CMD_ACK);
+        if(_CreditMode)
+            _Credit -= 2;
+    }
+    if(_HeldPing)
+    {
+        Serial.print((char)ESC_CHAR);
+        Serial.print((char)GO_CHAR);
+        if(_CreditMode)
+            _Credit -= 2;
+        _HeldPing = false;
+    }
+}
+
+/*---------------------------------------------------
+ waitCredit: use Size bytes of serial credit, waiting for the
+ UI to grant more if needed.  Like checkBufferFull, serial
+ transmit is turned off if no credit arrives within ACK_TIMEOUT
+ Input:   Size: bytes about to be sent, 0 to use one byte 
+          without waiting (non blocking)
+ returns: true if the bytes can be sent
+ ---------------------------------------------------*/
+boolean ArduEye::waitCredit(int Size)
+{
+    unsigned long elapsedTime = millis();
+    
+    // non blocking: credit arrives through the checkUIData() calls of the main loop
+    if(Size == 0)
+    {
+        if(_Credit <= 0)
+            return false;
+        _Credit--;
+        return true;
+    }
+    
+    PROF_START(Wait);
+    while(_Credit < Size)
+    {
+        checkUIData();
+        if(!_CreditMode)
+            break;
+        if(millis() - elapsedTime > ACK_TIMEOUT)
+        {
+            // no credit received
+            PROF_TIME(PROF_WAIT_US, Wait);
+            linkLost();
+            return false;
+        }
+    }
+    PROF_TIME(PROF_WAIT_US, Wait);
+    _Credit -= Size;
+    return true;
+}
+
+/*---------------------------------------------------
+ sendHeader: send a dataset header to the serial monitor
+ or the UI once the serial buffer is clear (if the UI does
+ not have it already, see headerChanged)
+ Input:   DSIdx: index of the dataset in _DS
+          Header: header read from the ArduEye
+ ---------------------------------------------------*/
+void ArduEye::sendHeader(int DSIdx, unsigned char *Header)
+{
+    PROF_DATASET(DSIdx);
+    if(!_SerialTx || !headerChanged(DSIdx, Header) || !checkBufferFull())
+        return;
+    
+    if(_SerialMonitorMode)
+    { 
+        // serial monitor mode is used primarily for debugging
+        // print header info in a legible way
+        unsigned char Out[FULL_HEAD_SIZE];
+        forwardHeader(DSIdx, Header, Out);
+        if(_SensorID != NULL_CHAR)
+        {
+            Serial.print("S"); Serial.print(_SensorID, DEC); Serial.print(" ");
+        }
+        Serial.print(_DS[DSIdx].DSID); Serial.print(" ");
+        Serial.print((Out[1] << 8) + Out[2], DEC); Serial.print(" ");
+        Serial.print((Out[3] << 8) + Out[4], DEC);Serial.print(" ");
+        Serial.print(_DS[DSIdx].DisplayType); Serial.print(" ");
+        Serial.println(" ");
+    }
+    else
+    {
+        // Send header data packet to UI
+        stageHeader(DSIdx, Header);
+        flushSerial(true);
+    }
+}
+
+/*---------------------------------------------------
+ sendDataStart, sendData, sendDataEnd: send a dataset
+ packet to the serial monitor or the UI.  In UI mode the
+ packet start is staged and sent with the first data block
+ ---------------------------------------------------*/
+void ArduEye::sendDataStart(int DSIdx, unsigned char *Header)
+{
+    if(!_SerialTx)
+        return;
+    
+    if(_SerialMonitorMode) // print to serial monitor mode
+    {
+        startROI(DSIdx, Header);
+        Serial.print(ESC_CHAR);
+        Serial.print(START_PCKT);
+        Serial.println(_DS[DSIdx].DSID,DEC);
+    }
+    else  // print to UI mode, sent along with the first data block
+        stageDataStart(DSIdx, Header);
+}
+
+void ArduEye::sendData(const char *Buf, int Size)
+{
+    if(!_SerialTx)
+        return;
+    
+    stageData(Buf, Size);
+    flushSerial(true);
+    // print a spacer for legibility in serial monitor mode
+    if(_SerialMonitorMode)
+        Serial.println(" ");
+}
+
+void ArduEye::sendDataEnd(int DSIdx)
+{
+    if(!_SerialTx)
+        return;
+    
+    if(_SerialMonitorMode) //send to serial monitor
+    {
+        _TxROI = false;
+        if(_DS[DSIdx].DisplayType == DISPLAY_TEXT)
+            Serial.print(_DS[DSIdx].name);
+        Serial.print((char)ESC_CHAR);
+        Serial.println((char)END_PCKT);
+    }
+    else     //send to UI
+    {
+        stageDataEnd(DSIdx);
+        flushSerial(true);
+    }
+}
+
+/*---------------------------------------------------
+ readDataSet: read a dataset payload from the ArduEye and
+ forward it via serial if serial link is active.  The data
+ is read MAX_SPI_PCKT_SIZE bytes at a time into 
+ _ReceiveBuffer, the last partial packet goes into Buf
+ (or _ReceiveBuffer if Buf is 0).  If Frame is given the whole
+ dataset is read into Frame instead.  Each packet is passed to
+ the dataset handler, if any, before it is forwarded
+ Input:   DSIdx: index of the dataset settings in _DS
+          DataSet: dataset ID
+          Header: header of the dataset
+          Buf: array for the last packet
+          Frame: array for the whole dataset, or 0
+ ---------------------------------------------------*/
+void ArduEye::readDataSet(int DSIdx, char DataSet, unsigned char *Header, char *Buf, char *Frame)
+{
+    requestPacket(SOD_CHAR, DataSet);
+    readPayload(DSIdx, DataSet, Header, Buf, Frame);
+    closePacket();
+}
+
+/*---------------------------------------------------
+ readPayload: read a dataset payload from an open SOD_CHAR
+ or frame request (see readDataSet for the arguments)
+ ---------------------------------------------------*/
+void ArduEye::readPayload(int DSIdx, char DataSet, unsigned char *Header, char *Buf, char *Frame)
+{
+    int Idx = 0, remaining;
+    int Cols = (Header[3] << 8) + Header[4];
+    int InSize = ((Header[1] << 8) + Header[2]) * Cols;
+    char *Packet = _ReceiveBuffer;
+    
+    if(!Buf)
+        Buf = _ReceiveBuffer;
+    
+    // read MAX_SPI_PCKT_SIZE bytes of data at a time (max size defined in ArduEye.h)
+    while(Idx + MAX_SPI_PCKT_SIZE < InSize)
+    {
+        if(Frame)
+            Packet = Frame + Idx;
+        readChunk(DataSet, Idx, Packet, MAX_SPI_PCKT_SIZE);
+        handleData(DSIdx, DataSet, Packet, MAX_SPI_PCKT_SIZE, Idx, Cols);
+        sendData(Packet, MAX_SPI_PCKT_SIZE);
+        
+        // check that serial buffer is clear every two packets
+        if(_SerialTx && Idx % (MAX_SPI_PCKT_SIZE * 2) == 0)
+            checkBufferFull();
+        Idx+= MAX_SPI_PCKT_SIZE;
+    }
+    remaining = InSize - Idx;
+    
+    if(Frame)
+        Buf = Frame + Idx;
+    
+    // get remaining data
+    if(remaining)
+    {
+        readChunk(DataSet, Idx, Buf, remaining);
+        handleData(DSIdx, DataSet, Buf, remaining, Idx, Cols);
+        sendData(Buf, remaining);
+    }
+}
+
+/*---------------------------------------------------
+ forwardPayload: pass a dataset held in memory to the
+ dataset handler and forward it via serial, in packets of
+ MAX_SPI_PCKT_SIZE bytes as if it was being read
+ Input:   DSIdx: index of the dataset settings in _DS
+          Header: header of the dataset
+          Data: the dataset
+ ---------------------------------------------------*/
+void ArduEye::forwardPayload(int DSIdx, unsigned char *Header, char *Data)
+{
+    int Idx, Size;
+    int Cols = (Header[3] << 8) + Header[4];
+    int InSize = ((Header[1] << 8) + Header[2]) * Cols;
+    
+    for(Idx = 0; Idx < InSize; Idx += Size)
+    {
+        Size = InSize - Idx;
+        if(Size > MAX_SPI_PCKT_SIZE)
+            Size = MAX_SPI_PCKT_SIZE;
+        handleData(DSIdx, _DS[DSIdx].DSID, Data + Idx, Size, Idx, Cols);
+        sendData(Data + Idx, Size);
+        
+        // check that serial buffer is clear every two packets
+        if(_SerialTx && Idx + Size < InSize && Idx % (MAX_SPI_PCKT_SIZE * 2) == 0)
+            checkBufferFull();
+    }
+}
+
+/*---------------------------------------------------
+ handleData: pass a packet of dataset data to the handler
+ registered with setDataSetHandler()
+ Input:   DSIdx: index of the dataset settings in _DS
+          DataSet: dataset ID
+          Data, Size: the packet
+          Idx: offset of the packet in the dataset
+          Cols: columns of the dataset
+ ---------------------------------------------------*/
+void ArduEye::handleData(int DSIdx, char DataSet, char *Data, int Size, int Idx, int Cols)
+{
+    if(_DS[DSIdx].Handler && _DS[DSIdx].DSID == DataSet && Cols > 0)
+        _DS[DSIdx].Handler(DataSet, Data, Size, Idx / Cols, Idx % Cols);
+}
+
+/*---------------------------------------------------
+ setDataSetHandler: register a function to receive a dataset
+ as it is read, one SPI packet at a time, without copying it 
+ to a user buffer and without the MAX_SPI_PCKT_SIZE limit of
+ getDataSet.  The handler is called by getData(), getDataSet()
+ and poll() as
+     Handler(DataSet, Data, Size, Row, Col)
+ where Data holds Size bytes starting at (Row, Col) of the
+ dataset.  Data may be modified in place, it is forwarded to
+ the UI after the handler returns
+ Input:   DataSet: Any of the values defined as "Dataset IDs"
+            in the Sensor header file (ie ArmSensor.h)
+          Handler: function to call, or 0 to remove the handler
+ ---------------------------------------------------*/
+void ArduEye::setDataSetHandler(char DataSet, DataSetHandler Handler)
+{
+    int i = getDataIndex(DataSet);
+    
+    if(i >= 0)
+        _DS[i].Handler = Handler;
+}
+
+/*---------------------------------------------------
+ setReferenceBuffer: give a buffer to keep the last frame of
+ a dataset.  When the UI enables COMPRESS_FRAME, the dataset
+ is sent as the difference from the previous frame, which is
+ mostly zero runs for a static scene.  Without a buffer (or if
+ the dataset is larger than Size) the difference from the 
+ previous byte is sent instead
+ Input:   DataSet: ARDUEYE_ID_RAW or ARDUEYE_ID_OF
+          Buf: array of Size bytes, or 0 to remove the buffer
+          Size: size of Buf (rows * cols of the dataset)
+ ---------------------------------------------------*/
+void ArduEye::setReferenceBuffer(char DataSet, char *Buf, int Size)
+{
+    int i = getDataIndex(DataSet);
+    
+    if(i < 0)
+        return;
+    _DS[i].Ref = Buf;
+    _DS[i].RefMax = Buf ? Size : 0;
+    _DS[i].RefSize = 0;
+}
+
+/*---------------------------------------------------
+ scheduleFrame: pick the active datasets to read this frame
+ into _FrameSets.  A dataset is due every Divisor frames (see
+ setDataSetRate).  Due datasets are taken by priority, then 
+ the most overdue first, as long as their last size fits in
+ the frame budget (see setFrameBudget).  The budget left over
+ is saved while a dataset is waiting, so a large dataset goes 
+ out once enough has been saved, without holding back the
+ datasets that fit every frame
+ ---------------------------------------------------*/
+void ArduEye::scheduleFrame()
+{
+    int k, m, DSIdx, NumDue = 0;
+    unsigned char Due[MAX_DATASETS];
+    boolean Waiting = false;
+    DSRecord *DS, *Prev;
+    
+    PROF_FRAME_START();
+    
+    // the UI answered after the link was lost, resume serial output
+    // (with a full credit window, the UI buffer is clear)
+    if(_LinkBack)
+    {
+        enableSerialTx(true);
+        _Credit = _CreditWindow;
+    }
+    
+    // due datasets in the order they are taken (ties keep the _ActiveSets order)
+    for (k = 0; k < _NumActiveSets; k++)
+    {
+        DSIdx = _ActiveSets[k];
+        DS = &_DS[DSIdx];
+        if(++DS->Skipped < DS->Divisor)
+            continue;
+        
+        for(m = NumDue; m > 0; m--)
+        {
+            Prev = &_DS[Due[m-1]];
+            if(Prev->Priority > DS->Priority || (Prev->Priority == DS->Priority && 
+               Prev->Skipped / Prev->Divisor >= DS->Skipped / DS->Divisor))
+                break;
+            Due[m] = Due[m-1];
+        }
+        Due[m] = DSIdx;
+        NumDue++;
+    }
+    
+    // take them while they fit in the budget
+    _BudgetLeft += _FrameBudget;
+    _NumFrameSets = 0;
+    for (k = 0; k < NumDue; k++)
+    {
+        DS = &_DS[Due[k]];
+        if(_FrameBudget > 0 && DS->LastSize > _BudgetLeft)
+        {
+            Waiting = true;
+            continue;
+        }
+        _FrameSets[_NumFrameSets++] = Due[k];
+        _BudgetLeft -= DS->LastSize;
+        DS->Skipped = 0;
+    }
+    if(!Waiting)
+        _BudgetLeft = 0;
+}
+
+// record the size of a dataset sent to the UI, for the frame budget
+void ArduEye::updateSize(int DSIdx, unsigned char *Header)
+{
+    unsigned char Out[FULL_HEAD_SIZE];
+    
+    forwardHeader(DSIdx, Header, Out);
+    _DS[DSIdx].LastSize = ((Out[1] << 8) + Out[2]) * ((Out[3] << 8) + Out[4]);
+}
+
+/*---------------------------------------------------
+ setDataSetRate: read a dataset every Divisor frames instead
+ of every frame, e.g. to send RAW images now and then while 
+ OF is read every frame.  Priority orders the datasets due
+ on a frame when they do not all fit in the frame budget
+ (higher first).  The UI can also set it with RATE_CMD
+ Input:   DataSet: Any of the values defined as "Dataset IDs"
+            in the Sensor header file (ie ArmSensor.h)
+          Divisor: read every Divisor frames (1 = every frame)
+          Priority: higher is read first (default 0)
+ ---------------------------------------------------*/
+void ArduEye::setDataSetRate(char DataSet, int Divisor, int Priority)
+{
+    int i = getDataIndex(DataSet);
+    
+    if(i < 0)
+        return;
+    _DS[i].Divisor = (Divisor > 0) ? Divisor : 1;
+    _DS[i].Priority = Priority;
+    _DS[i].Skipped = _DS[i].Divisor - 1;
+}
+
+/*---------------------------------------------------
+ setFrameBudget: limit the dataset bytes sent to the UI per
+ frame by getData() and poll().  Datasets that do not fit
+ are left for a later frame.  The budget must cover the 
+ datasets due every frame for the others to go out
+ Input:   Bytes: payload bytes per frame, 0 for no limit
+ ---------------------------------------------------*/
+void ArduEye::setFrameBudget(unsigned int Bytes)
+{
+    _FrameBudget = Bytes;
+    _BudgetLeft = 0;
+}
+
+/*---------------------------------------------------
+ setFrameBuffer: read each frame into Buf in getData() and
+ poll(), then send END_FRAME before the frame is passed to 
+ the dataset handlers and forwarded to the UI.  The ArduEye 
+ captures the next frame while this one is processed, instead
+ of waiting for endFrame(), so the frame rate is limited by 
+ the slowest of the two rather than by their sum.  Buf holds
+ the header (FULL_HEAD_SIZE bytes) and payload of each 
+ dataset read in a frame.  Reading stops at the first 
+ dataset that does not fit, the rest of the frame is lost
+ Input:   Buf: array of Size bytes, or 0 to read and forward
+            datasets as they arrive
+          Size: size of Buf
+ ---------------------------------------------------*/
+void ArduEye::setFrameBuffer(char *Buf, int Size)
+{
+    _FrameBuf = Buf;
+    _FrameBufSize = Buf ? Size : 0;
+}
+
+/*---------------------------------------------------
+ readFrameBuffer: read the datasets in _FrameSets into the
+ frame buffer, each as its header followed by its payload.
+ A header with an incorrect size is kept (so it is sent to
+ the UI) and ends the read, as in getData()
+ returns: number of datasets stored
+ ---------------------------------------------------*/
+int ArduEye::readFrameBuffer()
+{
+    int k, DSIdx, InSize, Used = 0;
+    unsigned char *Header;
+    
+    if(_FrameRequest && _NumFrameSets > 0)
+        requestFrame();
+    
+    for(k = 0; k < _NumFrameSets; k++)
+    {
+        DSIdx = _FrameSets[k];
+        if(Used + FULL_HEAD_SIZE > _FrameBufSize)
+        {
+            PROF_ADD(PROF_DROPPED, 1);
+            break;
+        }
+        Header = (unsigned char *)_FrameBuf + Used;
+        InSize = readFrameHeader(DSIdx, Header);
+        updateSize(DSIdx, Header);
+        
+        if(InSize <= 0)
+        {
+            PROF_ADD(PROF_DROPPED, 1);
+            k++;
+            break;
+        }
+        if(Used + FULL_HEAD_SIZE + InSize > _FrameBufSize)
+        {
+            PROF_ADD(PROF_DROPPED, 1);
+            break;
+        }
+        
+        if(!_FrameOpen)
+            requestPacket(SOD_CHAR, _DS[DSIdx].DSID);
+        readChunk(_DS[DSIdx].DSID, 0, (char *)Header + FULL_HEAD_SIZE, InSize);
+        // closes a request resumed after a CRC error too
+        if(!_FrameOpen)
+            closePacket();
+        Used += FULL_HEAD_SIZE + InSize;
+    }
+    if(_FrameOpen)
+        closePacket();
+    return k;
+}
+
+/*---------------------------------------------------
+ getData: get data from active datasets
+ this command can be run each loop to acquire data
+ dataRdy() must be checked before running getData()
+ ---------------------------------------------------*/
+void ArduEye::getData()
+{
+	int k, DSIdx, InSize, Sets, Used = 0;
+	unsigned char Header[FULL_HEAD_SIZE], *Stored;
+    
+    // a read of another sensor on the bus is in progress
+    if(spiBusy())
+        return;
+      
+    // pick the datasets to read this frame
+    scheduleFrame();
+    
+    // read the frame, let the ArduEye start the next one, then forward it
+    if(_FrameBuf)
+    {
+        Sets = readFrameBuffer();
+        _FramePending = false;
+        sendCommand(END_FRAME);
+        
+        for (k = 0; k < Sets; k++)
+        {
+            DSIdx = _FrameSets[k];
+            Stored = (unsigned char *)_FrameBuf + Used;
+            InSize = ((Stored[1] << 8) + Stored[2]) * ((Stored[3] << 8) + Stored[4]);
+            
+            sendHeader(DSIdx, Stored);
+            if(InSize <= 0)
+                break;
+            sendDataStart(DSIdx, Stored);
+            forwardPayload(DSIdx, Stored, (char *)Stored + FULL_HEAD_SIZE);
+            sendDataEnd(DSIdx);
+            Used += FULL_HEAD_SIZE + InSize;
+        }
+        
+        if((_NumActiveSets > 0) && _SerialTx && !_SerialMonitorMode)
+        {
+            stageEndFrame();
+            flushSerial(true);
+        }
+        PROF_FRAME_END();
+        clearTemporaryDataSet();
+        return;
+    }
+    
+    if(_FrameRequest && _NumFrameSets > 0)
+        requestFrame();
+    
+    // loop through scheduled datasets
+    for (k = 0; k < _NumFrameSets; k++)
+    {
+        DSIdx = _FrameSets[k];
+        
+      	// read data packet header
+        InSize = readFrameHeader(DSIdx, Header);
+        updateSize(DSIdx, Header);
+       
+		// write header data to serial monitor or UI if active
+        sendHeader(DSIdx, Header);
+        
+        // abort read if size data is incorrect
+        if(InSize <= 0)
+        {
+            PROF_ADD(PROF_DROPPED, 1);
+            break;
+        }
+          
+        // read data packet and send via serial if _SerialTx is active
+        sendDataStart(DSIdx, Header);
+        if(_FrameOpen)
+        {
+            readPayload(DSIdx, _DS[DSIdx].DSID, Header, 0);
+            // a chunk was requested again after a CRC error, ending the frame request
+            if(!_FrameOpen)
+                closePacket();
+        }
+        else
+            readDataSet(DSIdx, _DS[DSIdx].DSID, Header, 0);
+        sendDataEnd(DSIdx);
+    } 
+    if(_FrameOpen)
+        closePacket();
+    // when all datasets are received, call end of frame  
+    endFrame();
+  
+    // clear TemporaryDatSet if active
+    clearTemporaryDataSet();
+}
+
+/*---------------------------------------------------
+ clearTemporaryDataSet: stop a one time dataset request
+ once it has been sent
+ ---------------------------------------------------*/
+void ArduEye::clearTemporaryDataSet()
+{
+    int DSIdx = getDataIndex(_TemporaryDataSet);
+    
+    // wait until it has been read if the scheduler skipped it
+    if(_TemporaryDataSet >= 0 && _DS[DSIdx].Skipped == 0)
+    {	
+        stopDataStream(_TemporaryDataSet);
+        _TemporaryDataSet = NULL_CHAR;
+	}
+}
+
+/*---------------------------------------------------
+ poll: non-blocking version of dataRdy()/getData()
+ Each call does a bounded amount of work on the current
+ frame: one header read, one POLL_CHUNK_SIZE payload read,
+ or writing serial bytes while the serial port is free.
+ Call poll() every loop instead of dataRdy() and getData()
+ returns: true when the call completed a frame
+ Serial Monitor mode output is not staged and still blocks.
+ Commands sent while a dataset is being read are held and
+ sent when the read is finished (one command can be held).
+ Chip select stays low between calls while a payload or a
+ frame request is read, see setChunkRequest
+ ---------------------------------------------------*/
+boolean ArduEye::poll()
+{
+    int Size;
+    char *Data;
+    
+    // staged serial output must be sent before moving on
+    if(_AcqState == ACQ_FLUSH)
+    {
+        if(!flushSerial(false))
+        {
+            // no credit since the flush started or the last credit
+            if(_CreditMode && _Credit <= 0 && millis() - _AckTime > ACK_TIMEOUT)
+            {
+                linkLost();
+                _AcqState = _AcqNext;
+            }
+            return false;
+        }
+        _AcqState = _AcqNext;
+        return false;
+    }
+    
+    switch(_AcqState)
+    {
+        // wait for the ArduEye to flag a new frame
+        case ACQ_IDLE:
+            if(!dataRdy())
+                return false;
+            scheduleFrame();
+            if(_FrameRequest && _NumFrameSets > 0)
+                requestFrame();
+            _AcqSet = 0;
+            _AcqBuffered = (_FrameBuf != 0);
+            _AcqState = _AcqBuffered ? ACQ_BUFFER : ACQ_HEADER;
+            _AcqIdx = -1;
+            _BufUsed = 0;
+            return false;
+            
+        // read the frame into the frame buffer: a header, or a chunk of a payload
+        case ACQ_BUFFER:
+            if(_AcqIdx < 0)
+            {
+                if(_AcqSet < _NumFrameSets && _BufUsed + FULL_HEAD_SIZE <= _FrameBufSize)
+                {
+                    _AcqDS = _FrameSets[_AcqSet];
+                    _AcqSize = readFrameHeader(_AcqDS, (unsigned char *)_FrameBuf + _BufUsed);
+                    updateSize(_AcqDS, (unsigned char *)_FrameBuf + _BufUsed);
+                    if(_AcqSize > 0 && _BufUsed + FULL_HEAD_SIZE + _AcqSize <= _FrameBufSize)
+                    {
+                        if(!_FrameOpen && !_ChunkRequest)
+                            requestPacket(SOD_CHAR, _DS[_AcqDS].DSID);
+                        _AcqIdx = 0;
+                        return false;
+                    }
+                    // keep a header with an incorrect size for the UI
+                    if(_AcqSize <= 0)
+                    {
+                        _BufUsed += FULL_HEAD_SIZE;
+                        _AcqSet++;
+                    }
+                    else
+                        PROF_ADD(PROF_DROPPED, 1);
+                }
+                else if(_AcqSet < _NumFrameSets)
+                    PROF_ADD(PROF_DROPPED, 1);
+                
+                // frame read, let the ArduEye start the next one and forward this one
+                if(_FrameOpen)
+                    closePacket();
+                _BufSets = _AcqSet;
+                _FramePending = false;
+                sendCommand(END_FRAME);
+                _AcqSet = 0;
+                _BufUsed = 0;
+                _AcqState = ACQ_HEADER;
+                return false;
+            }
+            Size = _AcqSize - _AcqIdx;
+            if(Size > POLL_CHUNK_SIZE)
+                Size = POLL_CHUNK_SIZE;
+            readPollChunk(_FrameBuf + _BufUsed + FULL_HEAD_SIZE + _AcqIdx, Size);
+            _AcqIdx += Size;
+            if(_AcqIdx >= _AcqSize)
+            {
+                if(!_FrameOpen)
+                    closePacket();
+                _BufUsed += FULL_HEAD_SIZE + _AcqSize;
+                _AcqSet++;
+                _AcqIdx = -1;
+            }
+            return false;
+            
+        // read the header of the next scheduled dataset
+        case ACQ_HEADER:
+            if(_AcqSet >= (_AcqBuffered ? _BufSets : _NumFrameSets))
+            {
+                if(_FrameOpen)
+                    closePacket();
+                _AcqState = ACQ_END_FRAME;
+                return false;
+            }
+            _AcqDS = _FrameSets[_AcqSet];
+            if(_AcqBuffered)
+            {
+                for(Size = 0; Size < FULL_HEAD_SIZE; Size++)
+                    _AcqHeader[Size] = _FrameBuf[_BufUsed + Size];
+                _AcqSize = ((_AcqHeader[1] << 8) + _AcqHeader[2]) * ((_AcqHeader[3] << 8) + _AcqHeader[4]);
+            }
+            else
+            {
+                _AcqSize = readFrameHeader(_AcqDS, _AcqHeader);
+                updateSize(_AcqDS, _AcqHeader);
+            }
+            _AcqIdx = 0;
+            
+            // check that the UI buffer is clear before sending the header
+            // (staged with the start of the data packet in UI mode)
+            if(!_SerialTx || _SerialMonitorMode)
+            {
+                sendHeader(_AcqDS, _AcqHeader);
+                _AcqState = ACQ_SEND_HEADER;
+            }
+            else if(!_CreditMode && headerChanged(_AcqDS, _AcqHeader))
+                startPing(ACQ_SEND_HEADER);
+            else
+                _AcqState = ACQ_SEND_HEADER;
+            return false;
+            
+        // wait for the UI to acknowledge a ping
+        case ACQ_ACK:
+            checkUIData();
+            if(_AckReceived)
+            {
+                PROF_TIME(PROF_WAIT_US, _ProfPing);
+                _AcqState = _AckNext;
+            }
+            else if(millis() - _AckTime > ACK_TIMEOUT)
+            {
+                // no ack received
+                PROF_TIME(PROF_WAIT_US, _ProfPing);
+                linkLost();
+                _AcqState = _AckNext;
+            }
+            return false;
+            
+        // send the header and the start of the data packet
+        case ACQ_SEND_HEADER:
+            // abort read if size data is incorrect
+            if(_AcqSize <= 0)
+            {
+                PROF_ADD(PROF_DROPPED, 1);
+                if(_FrameOpen)
+                    closePacket();
+                if(_SerialTx && !_SerialMonitorMode)
+                    stageHeader(_AcqDS, _AcqHeader);
+                startFlush(ACQ_END_FRAME);
+                return false;
+            }
+            if(_SerialTx && !_SerialMonitorMode)
+            {
+                stageHeader(_AcqDS, _AcqHeader);
+                stageDataStart(_AcqDS, _AcqHeader);
+            }
+            else
+                sendDataStart(_AcqDS, _AcqHeader);
+            if(!_FrameOpen && !_AcqBuffered && !_ChunkRequest)
+                requestPacket(SOD_CHAR, _DS[_AcqDS].DSID);
+            startFlush(ACQ_PAYLOAD);
+            return false;
+            
+        // read the next chunk of the payload
+        case ACQ_PAYLOAD:
+            if(_AcqIdx >= _AcqSize)
+            {
+                if(_AcqBuffered)
+                    _BufUsed += FULL_HEAD_SIZE + _AcqSize;
+                else if(!_FrameOpen)
+                    closePacket();
+                if(_SerialTx && !_SerialMonitorMode)
+                    stageDataEnd(_AcqDS);
+                else
+                    sendDataEnd(_AcqDS);
+                _AcqSet++;
+                startFlush(ACQ_HEADER);
+                return false;
+            }
+            Size = _AcqSize - _AcqIdx;
+            if(Size > POLL_CHUNK_SIZE)
+                Size = POLL_CHUNK_SIZE;
+            // payload from the frame buffer or the ArduEye
+            Data = _PollBuf;
+            if(_AcqBuffered)
+                Data = _FrameBuf + _BufUsed + FULL_HEAD_SIZE + _AcqIdx;
+            else
+                readPollChunk(Data, Size);
+            handleData(_AcqDS, _DS[_AcqDS].DSID, Data, Size, _AcqIdx, 
+                       (_AcqHeader[3] << 8) + _AcqHeader[4]);
+            _AcqIdx += Size;
+            
+            if(_SerialTx && !_SerialMonitorMode)
+            {
+                stageData(Data, Size);
+                // check that serial buffer is clear every two packets, 
+                // after the first, third, ... MAX_SPI_PCKT_SIZE bytes (as getData does)
+                if(_AcqIdx < _AcqSize && !_CreditMode &&
+                   (_AcqIdx + MAX_SPI_PCKT_SIZE) / (MAX_SPI_PCKT_SIZE * 2) != 
+                   (_AcqIdx - Size + MAX_SPI_PCKT_SIZE) / (MAX_SPI_PCKT_SIZE * 2))
+                {
+                    startFlush(ACQ_PING);
+                    return false;
+                }
+            }
+            else
+                sendData(Data, Size);
+            startFlush(ACQ_PAYLOAD);
+            return false;
+            
+        case ACQ_PING:
+            startPing(ACQ_PAYLOAD);
+            return false;
+            
+        // tell the ArduEye and the UI that the frame is over
+        case ACQ_END_FRAME:
+            // sent after the frame was read in frame buffer mode
+            if(!_AcqBuffered)
+            {
+                _FramePending = false;
+                sendCommand(END_FRAME);
+            }
+            if((_NumActiveSets > 0) && _SerialTx && !_SerialMonitorMode)
+                stageEndFrame();
+            startFlush(ACQ_DONE);
+            return false;
+            
+        case ACQ_DONE:
+            PROF_FRAME_END();
+            clearTemporaryDataSet();
+            _AcqState = ACQ_IDLE;
+            return true;
+            
+        default:
+            _AcqState = ACQ_IDLE;
+            return false;
+    }
+}
+
+/*---------------------------------------------------
+ readPollChunk: read the next chunk of the payload of _AcqDS
+ in poll(), from the open request, or with a request of its
+ own (see setChunkRequest)
+ Input:   Data: array for the bytes
+          Size: bytes to read
+ ---------------------------------------------------*/
+void ArduEye::readPollChunk(char *Data, int Size)
+{
+    char DataSet = _DS[_AcqDS].DSID;
+    
+    if(_FrameOpen || !_ChunkRequest)
+    {
+        readChunk(DataSet, _AcqIdx, Data, Size);
+        return;
+    }
+    // a frame request resumed after a CRC error is still open
+    if(!_SPIOpen)
+    {
+        if(_AcqIdx == 0)
+            requestPacket(SOD_CHAR, DataSet);
+        else
+            requestResume(DataSet, _AcqIdx);
+    }
+    readChunk(DataSet, _AcqIdx, Data, Size);
+    closePacket();
+}
+
+/*---------------------------------------------------
+ frameActive: true while poll() is in the middle of a frame
+ ---------------------------------------------------*/
+boolean ArduEye::frameActive()
+{
+    return _AcqState != ACQ_IDLE;
+}
+
+// send staged serial output, then move to state Next
+void ArduEye::startFlush(int Next)
+{
+    _AcqNext = Next;
+    _AckTime = millis();
+    _AcqState = ACQ_FLUSH;
+}
+
+// send a GO_CHAR ping to the UI, move to state Next once it is acknowledged
+void ArduEye::startPing(int Next)
+{
+    stageByte(ESC_CHAR);
+    stageByte(GO_CHAR);
+    _AckReceived = false;
+    _AckTime = millis();
+    _AckNext = Next;
+#ifdef ARDUEYE_PROFILE
+    _ProfPing = micros();
+#endif
+    startFlush(ACQ_ACK);
+}
+
+/*---------------------------------------------------
+ getDataIndex: find the settings of a dataset in _DS.  Dataset
+ ids are even, from DS_ID_FIRST on, so the id gives its slot
+ in DataSetSlots, built by the compiler from the dataset table
+ Input:   Dataset: Any of the values defined as "Dataset IDs"
+           in the Sensor header file (ie ArmSensor.h)
+ returns: index in _DS, -1 if the dataset is not in the table
+ ---------------------------------------------------*/
+int ArduEye::getDataIndex(char DataSet)
+{
+    int Slot = (DataSet - DS_ID_FIRST) >> 1;
+    
+    if((DataSet & 1) || Slot < 0 || Slot >= DS_ID_SLOTS)
+        return NULL_DS;
+    // signed, NULL_DS stays -1 where char is unsigned
+    return (signed char)pgm_read_byte(&DataSetSlots[Slot]);
+}
+/*---------------------------------------------------
+ getDataSet:  Acquire one dataset from ArduEye and send data
+ via serial if serial link is active.  Data will be stored in the 
+ Buf array.  The max size for Buf is 512 bytes. If the dataset is 
+ larger that this, Buf will contain a partial dataset (use 
+ getDataSet(DataSet, Buf, BufSize, Rows, Cols) or setDataSetHandler 
+ to receive all of it; Buf may then be 0).  This function
+ can be called each loop.  dataRdy() must be checked each loop before
+ getDataSet (getDataSet can be called for as many datasets as desired)and
+ endFrame() must be called each loop after all datasets are acquired.
+ Nothing is read while the SPI bus is busy (see spiBusy)
+ Input:   Dataset: Any of the values defined as "Dataset IDs"
+            in the Sensor header file (ie ArmSensor.h) 
+          Buf: Array to store Dataset
+ ---------------------------------------------------*/
+void ArduEye::getDataSet(char DataSet, char *Buf)
+{
+    int InSize;
+	unsigned char Header[FULL_HEAD_SIZE];
+    
+    // find index of DataSet Settings
+    int DataIdx = getDataIndex(DataSet);
+    if(DataIdx < 0 || spiBusy())
+        return;
+    
+	// read data packet header
+    InSize = readHeader(DataSet, Header);
+    PROF_ADD(PROF_COUNT, 1);
+    
+    // write header data to serial monitor or UI if active
+    sendHeader(DataIdx, Header);
+    
+    // abort read if size data is incorrect
+    if(InSize <= 0)
+    {
+        PROF_ADD(PROF_DROPPED, 1);
+        return;
+    }
+    
+    // read data packet and send via serial if _SerialTx is active
+    sendDataStart(DataIdx, Header);
+    readDataSet(DataIdx, DataSet, Header, Buf);
+    sendDataEnd(DataIdx);
+}
+
 /*---------------------------------------------------
- getDataSet:  Acquire one dataset from ArduEye and send data
- via serial if serial link is active.  Data will be stored in the 
- Buf array.  The max size for Buf is 512 bytes. If the dataset is 
- larger that this, Buf will contain a partial dataset.  This function
- can be called each loop.  dataRdy() must be checked each loop before
- getDataSet (getDataSet can be called for as many datasets as desired)and
- endFrame() must be called each loop after all datasets are acquired
- Input:   Dataset: Any of the values defined as "Dataset IDs"
-            in the Sensor header file (ie ArmSensor.h) 
+ getDataSet:  Acquire one whole dataset from ArduEye into Buf and
+ send data via serial if serial link is active.  Unlike 
+ getDataSet(DataSet, Buf), Buf holds the complete dataset (row by
+ row) no matter how large it is, provided BufSize is big enough.
+ dataRdy() must be checked before and endFrame() called after, as
+ for getDataSet(DataSet, Buf)
+ Input:   DataSet: Any of the values defined as "Dataset IDs"
+            in the Sensor header file (ie ArmSensor.h)
           Buf: Array to store Dataset
+          BufSize: size of Buf in bytes
+          Rows, Cols: set to the dataset size (may be 0)
+ Returns: number of bytes stored in Buf. 0 if no data was received
+          or if the dataset is larger than BufSize (the dataset is 
+          still read and forwarded, Rows and Cols give the size needed).
+          Nothing is read while the SPI bus is busy (see spiBusy)
  ---------------------------------------------------*/
-void ArduEye::getDataSet(char DataSet, char *Buf)
+int ArduEye::getDataSet(char DataSet, char *Buf, int BufSize, int *Rows, int *Cols)
 {
-    int i, k, InSize, Rows, Cols, c, Idx, remaining;
+    int InSize;
 	unsigned char Header[FULL_HEAD_SIZE];
-    //Header: 1 byte DataId, 2 byte rows, 2 byte cols
     
     // find index of DataSet Settings
     int DataIdx = getDataIndex(DataSet);
-    int DisplayType = _DS[DataIdx].DisplayType;
+    if(DataIdx < 0 || spiBusy())
+    {
+        if(Rows)
+            *Rows = 0;
+        if(Cols)
+            *Cols = 0;
+        return 0;
+    }
     
 	// read data packet header
-    digitalWrite(_chipSelectPin, LOW);
-    // set SPI link to Write mode
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(WRITE_CHAR);
-    
-    // request dataset header
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(START_PCKT);
-    SPI.transfer(SOH_CHAR); 
-    SPI.transfer(DataSet);
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(END_PCKT);
-    
-    // set spi link to read mode
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(READ_CHAR);
-    //delay to allow ArduEye time to prepare header
-    delayMicroseconds(1);
-    // read header data
-    for (i = 0; i < FULL_HEAD_SIZE; i++)
-        Header[i] = SPI.transfer(0x00);
-    digitalWrite(_chipSelectPin, HIGH);
-    
-    // assign row and colum data for serial display      
-    Rows = (Header[1] << 8) + Header[2];
-    Cols = (Header[3] << 8) + Header[4];
-    // assign incoming dataset size
-    InSize = Rows * Cols;
+    InSize = readHeader(DataSet, Header);
+    PROF_ADD(PROF_COUNT, 1);
+    if(Rows)
+        *Rows = InSize > 0 ? (Header[1] << 8) + Header[2] : 0;
+    if(Cols)
+        *Cols = InSize > 0 ? (Header[3] << 8) + Header[4] : 0;
     
     // write header data to serial monitor or UI if active
-    if(_SerialTx)
-    {
-        if(_SerialMonitorMode)
-        { 
-            // serial monitor mode is used primarily for debugging
-            // print header info in a legible way
-            if(checkBufferFull())
-            {
-                Serial.print(DataSet); Serial.print(" ");
-                Serial.print(Rows, DEC); Serial.print(" ");
-                Serial.print(Cols, DEC);Serial.print(" ");
-                Serial.print(DisplayType); Serial.print(" ");
-                Serial.println(" ");
-            }
-        }
-        else
-        {
-            // Send header data packet to UI if buffer is clear
-            if(checkBufferFull())
-            {
-                Serial.print((char)ESC_CHAR);
-                Serial.print((char)START_PCKT);  // send start of packet byte
-                for(i = 0; i < FULL_HEAD_SIZE; i++) // send header packet data
-                {
-                    Serial.print(Header[i]);
-                    if(Header[i] == ESC_CHAR)
-                        Serial.print(Header[i]);
-                }
-                Serial.print((char)DisplayType); // append display type
-                Serial.print((char)ESC_CHAR);
-                Serial.print((char)END_PCKT);  //send end of packet byte   
-            }
-        }
-    }
+    sendHeader(DataIdx, Header);
     
     // abort read if size data is incorrect
     if(InSize <= 0)
-        return;
-    
-    // send start of packet bytes via serial if _SerialTx is active
-    if(_SerialTx)
-    {
-        if(_SerialMonitorMode) // print to serial monitor mode
-        {
-            Serial.print(ESC_CHAR);
-            Serial.print(START_PCKT);
-            Serial.println(DataSet,DEC);
-        }
-        else  // print to UI mode
-        {
-            Serial.print((char)ESC_CHAR); 
-            Serial.print((char)START_PCKT); // send start of packet byte
-            Serial.print((char)DataSet); // send dataset ID
-            // text display has a different format to tell UI what to display
-            if(DisplayType == DISPLAY_TEXT)
-                Serial.print((char)Cols);
-        }
-    }
-    
-    
-    // read data packet 
-    // set spi link to write mode
-    digitalWrite(_chipSelectPin, LOW);
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(WRITE_CHAR);
-    
-    // request dataset
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(START_PCKT);
-    SPI.transfer(SOD_CHAR); 
-    SPI.transfer(DataSet);
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(END_PCKT);
-    
-    // set spi link to read mode
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(READ_CHAR);
-    // delay to allow the ArduEye time to prepare the dataset
-    delayMicroseconds(1);
-    Idx = 0;
-    // read MAX_SPI_PCKT_SIZE bytes of data at a time (max size defined in ArduEye.h)
-    while(Idx + MAX_SPI_PCKT_SIZE < InSize)
     {
-        for(i = 0; i < MAX_SPI_PCKT_SIZE; i++)
-            _ReceiveBuffer[i] = SPI.transfer(0x00);
-        
-        // send data via serial
-        if (_SerialTx)
-        { 
-            for (i = 0; i < MAX_SPI_PCKT_SIZE; i++)
-            {
-                Serial.print(_ReceiveBuffer[i]);
-                //duplicate the data character if it is equal to the ESC_CHAR
-                if(_ReceiveBuffer[i] == ESC_CHAR)
-                    Serial.print(_ReceiveBuffer[i]);
-            }
-            // print a spacer for legibility in serial monitor mode
-            if(_SerialMonitorMode)
-                Serial.println(" ");
-            
-            // check that serial buffer is clear every two packets
-            if(Idx % (MAX_SPI_PCKT_SIZE * 2) == 0)
-            {     
-                if(!checkBufferFull())
-                    break;
-            }
-        }
-        Idx+= MAX_SPI_PCKT_SIZE;
+        PROF_ADD(PROF_DROPPED, 1);
+        return 0;
     }
-    remaining = InSize - Idx;
     
-    // get remaining data
-    if(remaining)
-    {
-        for(i = 0; i < remaining; i++)
-            Buf[i] = SPI.transfer(0x00);
-        
-        // send data via serial
-        if (_SerialTx)
-        {   	
-            for (i = 0; i < remaining; i++)
-            {
-                Serial.print(Buf[i]);
-                //duplicate the data character if it is equal to the ESC_CHAR
-                if(Buf[i] == ESC_CHAR)
-                    Serial.print(Buf[i]);
-            }
-            if(_DS[_ActiveSets[k]].DisplayType == DISPLAY_TEXT)
-                Serial.print(_DS[DataIdx].name);
-            // print a spacer for legibility in serial monitor mode
-            if(_SerialMonitorMode)
-                Serial.println(" ");
-            
-        } 
-    }
-    digitalWrite(_chipSelectPin, HIGH);
+    // read data packet and send via serial if _SerialTx is active
+    sendDataStart(DataIdx, Header);
+    if(InSize <= BufSize)
+        readDataSet(DataIdx, DataSet, Header, 0, Buf);
+    else
+        readDataSet(DataIdx, DataSet, Header, 0);
+    sendDataEnd(DataIdx);
     
-    // send end of Packet bye
-    if(_SerialTx)
-    {
-        if(_SerialMonitorMode) //send to serial monitor
-        {
-            Serial.print((char)ESC_CHAR);
-            Serial.println((char)END_PCKT);
-        }
-        else     //send to UI
-        {
-            Serial.print((char)ESC_CHAR);
-            Serial.print((char)END_PCKT);
-        }
-        
-    }        
+    return InSize <= BufSize ? InSize : 0;
 }
 
 /*---------------------------------------------------
@@ -680,26 +2417,28 @@ void ArduEye::getDataSet(char DataSet, char *Buf)
 void ArduEye::endFrame()
 {
     //send End of Data Indicator to ArduEye
+    _FramePending = false;
     sendCommand(END_FRAME);
     
     // send End of Frame Indicator to UI
     if((_NumActiveSets > 0) && _SerialTx && !_SerialMonitorMode)
     {
-        Serial.print((char)ESC_CHAR);
-        Serial.print((char)START_PCKT);
-        Serial.print((char)END_FRAME);
-        Serial.print((char)ESC_CHAR);
-        Serial.print((char)END_PCKT);
+        stageEndFrame();
+        flushSerial(true);
     }
+    PROF_FRAME_END();
 }
 
 /*---------------------------------------------------
 dataRdy: check data ready pin to see if ArduEye Data is ready
 dataRdy() must be called each loop before getData()
+In data ready interrupt mode, returns the frame pending flag
  ---------------------------------------------------*/
 boolean ArduEye::dataRdy()
 {
-	return (digitalRead(_dataReadyPin) == HIGH);
+    if(_RdyInterrupt)
+        return _FramePending;
+    return (digitalRead(_dataReadyPin) == HIGH);
 }
 
 /*---------------------------------------------------
@@ -711,6 +2450,266 @@ boolean ArduEye::sensorRdy()
 	return (digitalRead(_dataReadyPin) == HIGH);
 }
 
+/*---------------------------------------------------
+enableDataRdyInterrupt: switch data ready detection between 
+polling the pin and a pin interrupt.  In interrupt mode a
+rising edge latches a frame pending flag (cleared when 
+END_FRAME is sent) and the micros() time of the edge
+Input:  Enable: true for interrupt mode, false for polling
+returns: false if the data ready pin has no interrupt
+---------------------------------------------------*/
+boolean ArduEye::enableDataRdyInterrupt(boolean Enable)
+{
+    int i, Free = -1;
+    
+    for(i = 0; i < MAX_SENSORS; i++)
+    {
+        if(_RdySensors[i] == this)
+            _RdySensors[i] = 0;
+        if(!_RdySensors[i] && Free < 0)
+            Free = i;
+    }
+    
+    _RdyInterrupt = false;
+    if(!Enable)
+    {
+        detachRdyInterrupt(_dataReadyPin);
+        return true;
+    }
+    if(Free < 0)
+        return false;
+    
+    // register before attaching, the handler may run at once
+    _RdySensors[Free] = this;
+    _RdyLevel = false;
+    _FramePending = false;
+    if(!attachRdyInterrupt(_dataReadyPin, dataRdyISR))
+    {
+        _RdySensors[Free] = 0;
+        return false;
+    }
+    _RdyInterrupt = true;
+    
+    // a frame may already be waiting
+    noInterrupts();
+    if(!_RdyLevel && digitalRead(_dataReadyPin) == HIGH)
+        latchFrame();
+    interrupts();
+    return true;
+}
+
+/*---------------------------------------------------
+dataRdyISR: data ready interrupt handler, checks the data
+ready pin of every ArduEye using the interrupt (pin change
+interrupts fire on both edges and may be shared)
+---------------------------------------------------*/
+void ArduEye::dataRdyISR()
+{
+    int i;
+    boolean Level;
+    ArduEye *Sensor;
+    
+    for(i = 0; i < MAX_SENSORS; i++)
+    {
+        Sensor = _RdySensors[i];
+        if(!Sensor)
+            continue;
+        Level = (digitalRead(Sensor->_dataReadyPin) == HIGH);
+        if(Level && !Sensor->_RdyLevel)
+            Sensor->latchFrame();
+        Sensor->_RdyLevel = Level;
+    }
+}
+
+/*---------------------------------------------------
+latchFrame: flag a pending frame and update the frame
+interval statistics (averages over ~16 frames)
+---------------------------------------------------*/
+void ArduEye::latchFrame()
+{
+    unsigned long Now = micros(), Deviation;
+    
+    _FramePending = true;
+    _RdyLevel = true;
+    if(_FrameCount > 0)
+    {
+        _FrameInterval = Now - _FrameTime;
+        if(_FrameCount == 1)
+            _IntervalAvg = _FrameInterval;
+        Deviation = (_FrameInterval > _IntervalAvg) ? _FrameInterval - _IntervalAvg 
+                                                    : _IntervalAvg - _FrameInterval;
+        _IntervalAvg = _IntervalAvg - (_IntervalAvg >> 4) + (_FrameInterval >> 4);
+        _JitterAvg = _JitterAvg - (_JitterAvg >> 4) + (Deviation >> 4);
+    }
+    if(_FrameCount < 2)
+        _FrameCount++;
+    _FrameTime = Now;
+}
+
+/*---------------------------------------------------
+frameTime, frameInterval, frameJitter: frame timing from 
+the data ready interrupt, in microseconds
+---------------------------------------------------*/
+unsigned long ArduEye::frameTime()
+{
+    unsigned long Time;
+    
+    noInterrupts();
+    Time = _FrameTime;
+    interrupts();
+    return Time;
+}
+
+unsigned long ArduEye::frameInterval()
+{
+    unsigned long Interval;
+    
+    noInterrupts();
+    Interval = _FrameInterval;
+    interrupts();
+    return Interval;
+}
+
+unsigned long ArduEye::frameJitter()
+{
+    unsigned long Jitter;
+    
+    noInterrupts();
+    Jitter = _JitterAvg;
+    interrupts();
+    return Jitter;
+}
+
+/*---------------------------------------------------
+ getProfile: performance counters since the last reset
+ (compiled in with ARDUEYE_PROFILE, see ArduEyePlatform.h).
+ Dataset counters cover the reads of that dataset and its
+ forwarding, frame counters everything done in getData(),
+ poll() or between endFrame() calls.  For frames PROF_COUNT
+ is the number of frames and PROF_DROPPED the frames that
+ lost a dataset or their serial output
+ Input:   DataSet: dataset ID, or ARDUEYE_ID_PROFILE for
+            the frame totals
+          Field: PROF_COUNT ... PROF_ACK_TIMEOUTS
+ returns: the counter, 0 if not compiled in
+ ---------------------------------------------------*/
+unsigned long ArduEye::getProfile(char DataSet, int Field)
+{
+#ifdef ARDUEYE_PROFILE
+    int DSIdx = getDataIndex(DataSet);
+    
+    if(Field < 0 || Field >= PROF_FIELDS)
+        return 0;
+    if(DataSet == ARDUEYE_ID_PROFILE)
+        return _ProfTotal[Field];
+    if(DSIdx >= 0)
+        return _DS[DSIdx].Prof[Field];
+#else
+    (void)DataSet;
+    (void)Field;
+#endif
+    return 0;
+}
+
+// counters of the last frame completed (PROF_DROPPED is the datasets it lost)
+unsigned long ArduEye::getFrameProfile(int Field)
+{
+#ifdef ARDUEYE_PROFILE
+    if(Field >= 0 && Field < PROF_FIELDS)
+        return _ProfLast[Field];
+#else
+    (void)Field;
+#endif
+    return 0;
+}
+
+// clear the performance counters
+void ArduEye::resetProfile()
+{
+#ifdef ARDUEYE_PROFILE
+    for(int i = 0; i < PROF_FIELDS; i++)
+    {
+        _ProfFrame[i] = _ProfLast[i] = _ProfTotal[i] = 0;
+        for(int k = 0; k < MAX_DATASETS; k++)
+            _DS[k].Prof[i] = 0;
+    }
+    _ProfDS = -1;
+    _ProfStart = _ProfPing = micros();
+#endif
+}
+
+#ifdef ARDUEYE_PROFILE
+// add Value to Field of the frame and of the dataset being read or forwarded
+void ArduEye::profileAdd(int Field, unsigned long Value)
+{
+    if(Field != PROF_COUNT)
+        _ProfFrame[Field] += Value;
+    if(_ProfDS >= 0)
+        _DS[_ProfDS].Prof[Field] += Value;
+}
+
+/*---------------------------------------------------
+ profileFrameEnd: keep the counters of the frame just
+ completed as the last frame, add them to the totals and
+ start counting the next one
+ ---------------------------------------------------*/
+void ArduEye::profileFrameEnd()
+{
+    unsigned long Now = micros();
+    
+    _ProfFrame[PROF_COUNT] = 1;
+    _ProfFrame[PROF_FRAME_US] = Now - _ProfStart;
+    for(int i = 0; i < PROF_FIELDS; i++)
+    {
+        _ProfLast[i] = _ProfFrame[i];
+        if(i == PROF_DROPPED)
+            _ProfTotal[i] += (_ProfFrame[i] > 0);
+        else
+            _ProfTotal[i] += _ProfFrame[i];
+        _ProfFrame[i] = 0;
+    }
+    _ProfStart = Now;
+    _ProfDS = -1;
+}
+
+/*---------------------------------------------------
+ profileHeader, profileData: ARDUEYE_ID_PROFILE is made
+ here instead of being read from the ArduEye.  Row 0 holds
+ the frame totals, row k + 1 the counters of _DS[k], each
+ row the dataset ID then the PROF_FIELDS counters as 4 byte
+ big endian values (as they are when each byte is read)
+ ---------------------------------------------------*/
+int ArduEye::profileHeader(unsigned char *Header)
+{
+    int Rows = MAX_DATASETS + 1, Cols = 4 * (PROF_FIELDS + 1);
+    
+    Header[0] = ARDUEYE_ID_PROFILE;
+    Header[1] = Rows >> 8;
+    Header[2] = Rows & 0xFF;
+    Header[3] = Cols >> 8;
+    Header[4] = Cols & 0xFF;
+    Header[5] = 0;
+    return Rows * Cols;
+}
+
+void ArduEye::profileData(int Idx, char *Data, int Size)
+{
+    int Row, Col, Cols = 4 * (PROF_FIELDS + 1);
+    unsigned long Value;
+    
+    for(int i = 0; i < Size; i++, Idx++)
+    {
+        Row = Idx / Cols;
+        Col = Idx % Cols;
+        if(Row == 0)
+            Value = (Col < 4) ? ARDUEYE_ID_PROFILE : _ProfTotal[Col / 4 - 1];
+        else
+            Value = (Col < 4) ? (unsigned long)_DS[Row - 1].DSID : _DS[Row - 1].Prof[Col / 4 - 1];
+        Data[i] = Value >> (8 * (3 - Col % 4));
+    }
+}
+#endif
+
 /*---------------------------------------------------
 calibrate: send calibrate command to ArduEye
  calibrate generates a new Fixed Pattern noise mask for the vison chip
@@ -727,7 +2726,7 @@ Input:  rows:  number of pixel rows
 ---------------------------------------------------*/
 void ArduEye::setResolution(int rows, int cols)
 {
-	char Cmd[2] = {rows,cols};
+	char Cmd[2] = {(char)rows, (char)cols};
 	sendCommand(CMD_RESOLUTION, Cmd, 2);
 }
  
@@ -740,12 +2739,17 @@ void ArduEye::setResolution(int rows, int cols)
  ---------------------------------------------------*/
 void ArduEye::setOFResolution(int rows, int cols)
 {
-	char Cmd[2] = {rows,cols};
+	char Cmd[2] = {(char)rows, (char)cols};
 	sendCommand(CMD_OF_RESOLUTION, Cmd, 2);
 }
 
 /*---------------------------------------------------
  sendCommand: send a user defined command to the ArduEye via SPI
+ If a dataset read is in progress (a command sent from checkUIData
+ while waiting for a UI ack, or between calls to poll()), on this
+ sensor or on another of its ArduEyeBus, the command is held and
+ sent when the read is finished.  Only one command can be held, 
+ further commands are dropped
  Input:   Cmd: Cmd value
           Value: Array of command parameters
           Size: number of bytes to read in Value array
@@ -753,26 +2757,46 @@ void ArduEye::setOFResolution(int rows, int cols)
 void ArduEye::sendCommand(char Cmd, char * Value, int Size)
 {
 	int i;
+    
+    // resolution commands, sent directly or forwarded from the UI
+    invalidateHeaders((Cmd == WRITE_CMD && Size > 0) ? Value[0] : Cmd);
+    
+    // a dataset read is in progress, hold the command until it is finished
+    if(spiBusy())
+    {
+        if(_HeldCmdSize < 0 && Size <= MAX_CMD_SIZE)
+        {
+            _HeldCmd[0] = Cmd;
+            for(i = 0; i < Size; i++)
+                _HeldCmd[i + 1] = Value[i];
+            _HeldCmdSize = Size;
+        }
+        return;
+    }
+    
     // lower chip select
     digitalWrite(_chipSelectPin, LOW);
     
-    // set write mode
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(WRITE_CHAR);
-    // send command start bytes
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(START_PCKT); // Size = Cmd byte + size of value array
-    SPI.transfer(Cmd);
+    // set write mode and send command start bytes
+    byte Start[5] = {ESC_CHAR, WRITE_CHAR, ESC_CHAR, START_PCKT, (byte)Cmd};
+    byte End[2] = {ESC_CHAR, END_PCKT};
+    spiTransferBlock(Start, 0, 5);
 
     // send command values
-	for (i = 0; i < Size; i++)
-	  	SPI.transfer(Value[i]);
-    SPI.transfer(ESC_CHAR);
-    SPI.transfer(END_PCKT);
+    spiTransferBlock((byte *)Value, 0, Size);
+    spiTransferBlock(End, 0, 2);
 
     // raise chip select
 	digitalWrite(_chipSelectPin, HIGH);
     
+    // CRC trailers from the next request on, set directly or forwarded from the UI
+    if(Cmd == CMD_CRC && Size > 0)
+        _CRCMode = Value[0];
+    else if(Cmd == WRITE_CMD && Size > 1 && Value[0] == CMD_CRC)
+        _CRCMode = Value[1];
+    if(_CRCMode != CRC_16 && _CRCMode != CRC_32)
+        _CRCMode = CRC_NONE;
+    
     // print command to Serial Monitor if active.
     if(_SerialMonitorMode && _SerialTx)  
     { 
@@ -790,114 +2814,198 @@ void ArduEye::sendCommand(char Cmd, char * Value, int Size)
 
 /*---------------------------------------------------
  checkUIDATA: check communicatin from UI and process 
-
+ the bytes received since the last call, from the serial
+ port and from receiveUIByte().  Packets may be split 
+ across any number of calls
+ returns: true if an ACK_CHAR was received
  ---------------------------------------------------*/
 bool ArduEye::checkUIData(void)
 {
 	int i;
 	int BytesReceived; 
     bool AckReceived = false;
-    int FrameIdx = _InBufIdx;
+    ArduEye *Rx = _RxQueue;
+    boolean Overflow = Rx->_RxOverflow;
+    unsigned char Head = Rx->_RxHead;
+    char Data;
     
-    // check for available data on the serial port
-    BytesReceived = Serial.available();
+    // bytes queued by an interrupt handler.  After an overflow the queue has
+    // been full since, so the lost bytes follow those up to Head
+    while(Rx->_RxTail != Head)
+    {
+        Data = Rx->_RxRing[Rx->_RxTail];
+        Rx->_RxTail = (Rx->_RxTail + 1) & (RX_RING_SIZE - 1);
+        if(decodeUIByte(Data))
+            AckReceived = true;
+    }
+    // drop the packet that lost bytes
+    if(Overflow)
+    {
+        Rx->_RxOverflow = false;
+        _RxEsc = false;
+        _CmdLen = NULL_CHAR;
+    }
     
-    // if there is not enough space in the buffer to record the new data
-    // if not set the _InBufIdx to zero and continue recording there
-    if(_InBufIdx + BytesReceived > MAX_IN_SERIAL)
+    // the link was lost, ping the UI now and then
+    if(_LinkLost && !_LinkBack && millis() - _LinkTime > ACK_TIMEOUT)
     {
-        _BufEnd = _InBufIdx;
-        _InBufIdx = 0;
+        sendControl(GO_CHAR);
+        _LinkTime = millis();
     }
-    //  if data is available, copy it into the _InBuffer
+    else
+        sendHeldControl();
+    
+    // check for available data on the serial port
+    BytesReceived = Serial.available();
 	if(BytesReceived)
 	{
 		for (i = 0; i < BytesReceived; i++)
-            _InBuffer[_InBufIdx++] = Serial.read();
+            if(decodeUIByte(Serial.read()))
+                AckReceived = true;
         
         Toggle2 = !Toggle2;
         if(Toggle2)
             digitalWrite(7, HIGH);
         else
             digitalWrite(7, LOW);
-        delay(1);
     }
+    return AckReceived;
+}
+
+/*---------------------------------------------------
+ receiveUIByte: queue a byte received from the UI.  For 
+ sketches that take the serial receive interrupt and pass 
+ each byte here instead of leaving it to the Serial buffer.
+ Safe to call from an interrupt while the main loop calls
+ checkUIData() (single producer, single consumer)
+ Input:   Data: byte received
+ returns: false if the queue is full and the byte was lost
+ ---------------------------------------------------*/
+boolean ArduEye::receiveUIByte(char Data)
+{
+    unsigned char Next = (_RxHead + 1) & (RX_RING_SIZE - 1);
     
-    // for each byte receieced, check for special character
-    for (i = 0; i < BytesReceived; i++)
+    if(Next == _RxTail)
     {
-        if(_ESCReceived)
-        {   
-            
-            switch(_InBuffer[FrameIdx + i])
+        _RxOverflow = true;
+        return false;
+    }
+    _RxRing[_RxHead] = Data;
+    _RxHead = Next;
+    return true;
+}
+
+/*---------------------------------------------------
+ decodeUIByte: decode the next byte from the UI.  Flow 
+ control bytes (ESC ACK_CHAR, ESC CREDIT_CHAR) are handled
+ as they arrive, command packets (ESC START_PCKT ... ESC 
+ END_PCKT) are collected in _CmdBuf and passed to parseCmd.
+ In a packet, ESC ESC is a single ESC_CHAR and an ESC_CHAR
+ before any other byte is kept as data.  Packets longer
+ than MAX_CMD_SIZE are dropped
+ Input:   Data: byte received
+ returns: true for an ACK_CHAR
+ ---------------------------------------------------*/
+boolean ArduEye::decodeUIByte(char Data)
+{
+    int i;
+    
+    // check for escape characters.  The ESC_CHAR is sent at the beginning of all communcation.  
+    if(!_RxEsc)
+    {
+        if(Data == ESC_CHAR)
+            _RxEsc = true;
+        else
+            storeCmdByte(Data);
+        return false;
+    }
+    
+    _RxEsc = false;
+    switch(Data)
+    {
+        case START_PCKT:
+            _CmdLen = 0;
+            Toggle = !Toggle;
+            if(Toggle)
+                digitalWrite(6, HIGH);
+            else
+                digitalWrite(6, LOW);
+            break;
+        case END_PCKT:
+            if(_CmdLen > 0 && _CmdLen <= MAX_CMD_SIZE)
             {
-                case START_PCKT:
-                    _InSIdx = FrameIdx + i;
-                    Toggle = !Toggle;
-                    if(Toggle)
-                        digitalWrite(6, HIGH);
-                    else
-                        digitalWrite(6, LOW);
-                    
-                    break;
-                case END_PCKT:
-                    parseCmd(_InSIdx, FrameIdx + i);
-                    break;
-                // Ack char is sent by the UI in response to a ping from the Arduino requesting permission to continue.  If the
-                // serial buffer is overflowing ACK_CHAR will not sent
-                case ACK_CHAR:
-                    AckReceived = true;
-                    break;
-                case ESC_CHAR:
-                    //ignore
-                default:
-                    break;
+                // values missing from a short command read as 0
+                for(i = _CmdLen; i < MAX_CMD_SIZE; i++)
+                    _CmdBuf[i] = 0;
+                parseCmd(_CmdBuf, _CmdLen);
             }
-            _ESCReceived = false;
-        }
-        // check for escape characters.  The ESC_CHAR is sent at the beginning of all communcation.  
-        else if(_InBuffer[FrameIdx + i] == ESC_CHAR)
-            _ESCReceived = true;
-        
+            _CmdLen = NULL_CHAR;
+            break;
+        // Ack char is sent by the UI in response to a ping from the Arduino requesting permission to continue.  If the
+        // serial buffer is overflowing ACK_CHAR will not sent
+        case ACK_CHAR:
+            _AckReceived = true;
+            _LinkBack = _LinkLost;
+            return true;
+        // credit char is sent by the UI in credit mode each time it has taken CREDIT_UNIT bytes
+        case CREDIT_CHAR:
+            _Credit += CREDIT_UNIT;
+            _AckTime = millis();
+            _LinkBack = _LinkLost;
+            break;
+        case ESC_CHAR:
+            storeCmdByte(ESC_CHAR);
+            break;
+        default:
+            storeCmdByte(ESC_CHAR);
+            storeCmdByte(Data);
+            break;
     }
-    return AckReceived;
+    return false;
+}
+
+// add a byte to the command packet being received
+void ArduEye::storeCmdByte(char Data)
+{
+    if(_CmdLen < 0)
+        return;
+    if(_CmdLen < MAX_CMD_SIZE)
+        _CmdBuf[_CmdLen++] = Data;
+    else
+        _CmdLen = MAX_CMD_SIZE + 1;
 }
 
 /*---------------------------------------------------
  parseCmd: Process UI command and send to ArduEye if 
  appropriate. 
- Input:  StartIdx: Index of START_PCKT flag
-         EndIdx: Index of END_PCKT flag
+ Input:  cmd: command packet (MAX_CMD_SIZE bytes, unused 
+           bytes are 0)
+         Size: length of the packet
  ---------------------------------------------------*/
-void ArduEye::parseCmd(int StartIdx, int EndIdx)
+void ArduEye::parseCmd(char *cmd, int Size)
 {
-	int i, Idx = 0;
-    //command buffer
-    char cmd[MAX_CMD_SIZE];
-    boolean on;
-    
     // if serial input is active, send Command Acknowledge
     // UI checks for Command Acknowledge and will re-send command if needed
     if(_SerialTx)
-    {
-        Serial.print((char)ESC_CHAR);
-        Serial.print((char)CMD_ACK);
-    }
+        sendControl(CMD_ACK);
+    
+    // on a bus, the command may be for another sensor
+    if(_Bus && _Bus->route(this, cmd, Size))
+        return;
+    execCmd(cmd, Size);
+}
+
+/*---------------------------------------------------
+ execCmd: carry out a UI command (see parseCmd)
+ Input:  cmd: command packet (MAX_CMD_SIZE bytes, unused 
+           bytes are 0)
+         Size: length of the packet
+ ---------------------------------------------------*/
+void ArduEye::execCmd(char *cmd, int Size)
+{
+	int i;
+    boolean on;
     
-    // Read data between start and end indices to a buffer
-    // case where packet wraps around the circular input buffer
-    if(StartIdx > EndIdx)
-    {
-        for(i = StartIdx+1; i < _BufEnd; i++)
-            cmd[Idx++] = _InBuffer[i];
-        for(i = 0; i < EndIdx-1; i++)
-            cmd[Idx++] = _InBuffer[i];
-    }
-    // case where data is in one non-wrapping sequence
-    else
-        for(i = StartIdx+1; i < EndIdx-1; i++)
-            cmd[Idx++] = _InBuffer[i];
-	
     // parse command
     switch(cmd[0])
     {
@@ -911,12 +3019,12 @@ void ArduEye::parseCmd(int StartIdx, int EndIdx)
         break;
       // write a command to the ArduEye
       case WRITE_CMD:
-          sendCommand(cmd[0], cmd + 1, Idx-1);
+          sendCommand(cmd[0], cmd + 1, Size-1);
       
           // print command to serial monitor if _SerialMonitorMode is active
           if(_SerialMonitorMode && _SerialTx)  
           {          
-            for(int i = 0; i < Idx; i++)
+            for(int i = 0; i < Size; i++)
               Serial.print(cmd[i]);
             Serial.println("  cmd sent");
           }
@@ -938,6 +3046,42 @@ void ArduEye::parseCmd(int StartIdx, int EndIdx)
             on = (cmd[1] > 0) ? true : false;
             enableSerialTx(on);
             break;
+        // start credit flow control with a window of cmd[1] * CREDIT_UNIT bytes, 
+        // counted from the CMD_ACK of this command.  0 returns to GO_CHAR/ACK_CHAR pings
+        case CREDIT_CMD:
+            _Credit = _CreditWindow = (long)(unsigned char)cmd[1] * CREDIT_UNIT;
+            _CreditMode = (cmd[1] != 0);
+            break;
+        // compress RAW and OF payloads, cmd[1] is the highest COMPRESS_ mode the UI decodes.  
+        // Compressed packets carry the mode used after the dataset ID
+        case COMPRESS_CMD:
+            _Compression = constrain(cmd[1], COMPRESS_NONE, COMPRESS_FRAME);
+            break;
+        // send headers only when they change, tagged with SOH_CHAR: cmd[1] = 1 on, 0 off
+        case HEADER_CMD:
+            _HeaderChange = (cmd[1] != 0);
+            for(i = 0; i < MAX_DATASETS; i++)
+                _DS[i].SentDisplay = -1;
+            break;
+        // CRC trailer on the packets sent to the UI: cmd[1] = CRC_16 or CRC_32, CRC_NONE off.
+        // The width changes at a frame boundary: packets after the first END_FRAME packet
+        // that follows the CMD_ACK of this command carry it, the packets before keep the old one
+        case CRC_CMD:
+            _NextCRC = (cmd[1] == CRC_16 || cmd[1] == CRC_32) ? cmd[1] : CRC_NONE;
+            // the CMD_ACK is held while a packet is going out (see sendControl)
+            _NextCRCAcked = (_HeldAcks == 0);
+            break;
+        // read a dataset every n frames: dataset, divisor, priority
+        case RATE_CMD:
+            if(Size >= 4)
+                setDataSetRate(cmd[1], (unsigned char)cmd[2], cmd[3]);
+            break;
+        // select the part of a dataset sent to the UI: dataset, row, col, rows, cols, step
+        case ROI_CMD:
+            if(Size >= 7)
+                setROI(cmd[1], (unsigned char)cmd[2], (unsigned char)cmd[3], 
+                       (unsigned char)cmd[4], (unsigned char)cmd[5], (unsigned char)cmd[6]);
+            break;
        default:
           break; 
     }
@@ -951,6 +3095,7 @@ void ArduEye::parseCmd(int StartIdx, int EndIdx)
 void ArduEye::enableSerialTx(boolean Enable)
 {
 	_SerialTx = Enable;
+    _LinkLost = _LinkBack = false;
 }
 /*---------------------------------------------------
 setSerialMonitorMode: SerialMonitorMode is disabled by default.  When enabled
@@ -963,6 +3108,61 @@ void ArduEye::setSerialMonitorMode(boolean Enable)
 	_SerialMonitorMode = Enable;
 }
 
+/*---------------------------------------------------
+sensorID: ID of the sensor on its ArduEyeBus, sent with its
+packets to the UI (SOS_CHAR sensor_id)
+returns: the ID, -1 if the sensor is not on a bus
+---------------------------------------------------*/
+char ArduEye::sensorID()
+{
+    return _SensorID;
+}
+
+/*---------------------------------------------------
+takeLink: take over the serial link from the sensor that
+held it on the bus: serial settings, flow control and the
+UI command being received.  Staged output has been sent
+Input:  From: sensor that held the link
+---------------------------------------------------*/
+void ArduEye::takeLink(ArduEye &From)
+{
+    int i;
+    
+    _Config = From._Config;
+    _SerialTx = From._SerialTx;
+    _SerialMonitorMode = From._SerialMonitorMode;
+    _RxEsc = From._RxEsc;
+    _CmdLen = From._CmdLen;
+    for(i = 0; i < MAX_CMD_SIZE; i++)
+        _CmdBuf[i] = From._CmdBuf[i];
+    _AckReceived = From._AckReceived;
+    _LinkLost = From._LinkLost;
+    _LinkBack = From._LinkBack;
+    _LinkTime = From._LinkTime;
+    _AckTime = From._AckTime;
+    _CreditMode = From._CreditMode;
+    _Credit = From._Credit;
+    _CreditWindow = From._CreditWindow;
+    _Compression = From._Compression;
+    _SerialCRC = From._SerialCRC;
+    _NextCRC = From._NextCRC;
+    _NextCRCAcked = From._NextCRCAcked;
+    From._NextCRC = NULL_CHAR;
+    // codes still held for the UI
+    _HeldAcks = From._HeldAcks;
+    _HeldPing = From._HeldPing;
+    From._HeldAcks = 0;
+    From._HeldPing = false;
+    
+    // HEADER_CMD was received by the other sensor
+    if(_HeaderChange != From._HeaderChange)
+    {
+        _HeaderChange = From._HeaderChange;
+        for(i = 0; i < MAX_DATASETS; i++)
+            _DS[i].SentDisplay = -1;
+    }
+}
+
 /*---------------------------------------------------
  setDisplayType: define display type for a given dataset
  Input:  DSID: Any of the values defined as "Dataset IDs"
@@ -972,15 +3172,11 @@ void ArduEye::setSerialMonitorMode(boolean Enable)
  ---------------------------------------------------*/
 void ArduEye::setDisplayType(int DSID, int DisplayType)
 {
-    for (int i = 0; i < MAX_DATASETS; i++)
-    {  
-        // if record matching DSID is found, set its DisplayType
-        if(_DS[i].DSID == DSID)
-        {
-            _DS[i].DisplayType = DisplayType;
-            break;
-        }
-    }
+    int i = getDataIndex(DSID);
+    
+    // if record matching DSID is found, set its DisplayType
+    if(i >= 0)
+        _DS[i].DisplayType = DisplayType;
 }
 	
 
@@ -34,7 +34,7 @@
 #ifndef ARDUEYE_H
 #define ARDUEYE_H
 
-#include <WProgram.h>
+#include "ArduEyePlatform.h"
 #include "ArmSensor.h"
 
 // high level cmd definitions
@@ -43,15 +43,33 @@
 #define STOP_CMD 35
 #define READ_CMD 40
 #define SERIAL_START 39
+#define CREDIT_CMD 41
+#define COMPRESS_CMD 43
+#define ROI_CMD 44
+#define RATE_CMD 45
+#define HEADER_CMD 46
+#define CRC_CMD 47
+// commands that follow go to sensor cmd[1] of an ArduEyeBus
+#define SENSOR_CMD 48
 
 // flow control byte definitions
 #define ACK_CHAR 34
 #define GO_CHAR 36
 #define CMD_ACK 37
+#define CREDIT_CHAR 42
+
+// bytes of serial credit granted by each CREDIT_CHAR
+#define CREDIT_UNIT 256
 
 // timeout on waiting for ack in milliseconds
 #define ACK_TIMEOUT 1000
 
+// serial link states (see linkStatus)
+#define LINK_OFF      0   // serial transmit turned off
+#define LINK_OK       1
+#define LINK_WAITING  2   // waiting for an ACK_CHAR or credit from the UI
+#define LINK_LOST     3   // the UI stopped answering, output resumes when it answers a ping
+
 // special bytes - comm packet flags (SPI & Serial)
 #define ESC_CHAR	  38
 #define START_PCKT 90
@@ -63,14 +81,66 @@
 #define READ_CHAR 94
 #define SOD_CHAR      95
 #define SOH_CHAR      96
+// frame request: SOF_CHAR count dataset_ids, the reply is the header
+// and payload of each dataset in turn
+#define SOF_CHAR      97
+// resume request: SOC_CHAR dataset_id offset_hi offset_lo, the reply is the
+// payload from byte offset on (offset is a multiple of CRC_CHUNK_SIZE)
+#define SOC_CHAR      98
+// sensor tag: serial packets of a sensor on an ArduEyeBus start with 
+// SOS_CHAR sensor_id (see ArduEyeBus.h)
+#define SOS_CHAR      99
+
+// CRC trailers (see setCRC and CRC_CMD): width in bits of the CRC sent after
+// each header, payload chunk and serial packet.  CRC_16 is CRC-16/CCITT-FALSE,
+// CRC_32 is CRC-32 without the final inversion (JAMCRC), sent high byte first
+#define CRC_NONE    0
+#define CRC_16      16
+#define CRC_32      32
+#define CRC_INIT    0xFFFFFFFFUL
+// payload bytes covered by each SPI trailer (divides POLL_CHUNK_SIZE and 
+// MAX_SPI_PCKT_SIZE, the ArduEye firmware uses the same)
+#define CRC_CHUNK_SIZE  64
+// times a header or chunk is requested again after failing its CRC check
+#define CRC_RETRIES     3
 
 // special bytes - NULL character	
 #define NULL_CHAR -1
 
 // max array sizes (Arduino pro mini has 1kB SRAM)
 #define MAX_SPI_PCKT_SIZE   512
-#define MAX_IN_SERIAL	40
+// bytes from the UI queued by receiveUIByte (a power of 2, at most 256)
+#define RX_RING_SIZE    32
 #define MAX_CMD_SIZE    10
+#define TX_BUF_SIZE     32
+// bytes sent per Serial.write call when flushing escaped data
+#define TX_BLOCK_SIZE   64
+// encoded bytes buffered by a non blocking flush
+#define TX_PEND_SIZE    6
+
+// serial compression of ARDUEYE_ID_RAW and ARDUEYE_ID_OF payloads (see encodeData)
+#define COMPRESS_NONE   0   // payload sent as is
+#define COMPRESS_DELTA  1   // difference from the previous byte, zero runs
+#define COMPRESS_FRAME  2   // difference from the previous frame, zero runs
+
+// a cached dataset header is used instead of requesting it once this many
+// reads in a row have returned the same header (see readFrameHeader)
+#define HEADER_CACHE_READS  3
+
+// payload bytes read per call to poll()
+#define POLL_CHUNK_SIZE 64
+
+// poll() acquisition states
+#define ACQ_IDLE        0
+#define ACQ_HEADER      1
+#define ACQ_SEND_HEADER 2
+#define ACQ_PAYLOAD     3
+#define ACQ_PING        4
+#define ACQ_ACK         5
+#define ACQ_FLUSH       6
+#define ACQ_END_FRAME   7
+#define ACQ_DONE        8
+#define ACQ_BUFFER      9
 
 // Display Commands
 #define DISPLAY_NONE  0
@@ -83,6 +153,103 @@
 // null flag
 #define NULL_DS       -1
 
+// max number of ArduEye instances using the data ready interrupt
+#define MAX_SENSORS   4
+
+// header bytes kept per dataset: the header without the dataset ID
+#define DS_HEAD_SIZE  (FULL_HEAD_SIZE - 1)
+
+// serial bytes written by linkTest()
+#define LINK_TEST_BYTES     512
+// ms linkTest() waits for a frame
+#define LINK_TEST_TIMEOUT   1000
+
+// performance counters (see getProfile, compiled in with ARDUEYE_PROFILE in ArduEyePlatform.h):
+// datasets or frames read, microseconds spent in the whole frame, SPI header reads, SPI payload
+// reads, serial forwarding and waits for the UI (checkBufferFull, credit), SPI and serial bytes
+// moved, dropped datasets or frames and ACK timeouts
+#define PROF_COUNT          0
+#define PROF_FRAME_US       1
+#define PROF_HEADER_US      2
+#define PROF_PAYLOAD_US     3
+#define PROF_SERIAL_US      4
+#define PROF_WAIT_US        5
+#define PROF_SPI_BYTES      6
+#define PROF_SERIAL_BYTES   7
+#define PROF_DROPPED        8
+#define PROF_ACK_TIMEOUTS   9
+#define PROF_FIELDS         10
+
+// dataset made by the library itself with the counters: a row for the frame totals
+// then one per dataset slot, each the dataset id then the PROF_FIELDS counters, as
+// 4 byte big endian values.  Stream it like any other dataset with startDataStream
+#define ARDUEYE_ID_PROFILE  60
+
+#ifdef ARDUEYE_PROFILE
+#define PROF_START(Start)       unsigned long Start = micros()
+#define PROF_TIME(Field, Start) profileAdd(Field, micros() - (Start))
+#define PROF_ADD(Field, Value)  profileAdd(Field, Value)
+#define PROF_DATASET(DSIdx)     (_ProfDS = (DSIdx))
+#define PROF_FRAME_START()      (_ProfStart = micros())
+#define PROF_FRAME_END()        profileFrameEnd()
+#else
+// statements that do nothing, so they can stand alone as the body of an if
+#define PROF_START(Start)       ((void)0)
+#define PROF_TIME(Field, Start) ((void)0)
+#define PROF_ADD(Field, Value)  ((void)0)
+#define PROF_DATASET(DSIdx)     ((void)0)
+#define PROF_FRAME_START()      ((void)0)
+#define PROF_FRAME_END()        ((void)0)
+#endif
+
+// dataset table: the datasets of the sensor (SENSOR_DATASETS in its header, ie 
+// ArmSensor.h), then ARDUEYE_ID_PROFILE when the counters are compiled in
+#ifdef ARDUEYE_PROFILE
+#define ARDUEYE_DATASETS(DS) SENSOR_DATASETS(DS) \
+    DS(ARDUEYE_ID_PROFILE, DISPLAY_DUMP, 0, false, 0, 0, 1)
+#else
+#define ARDUEYE_DATASETS(DS) SENSOR_DATASETS(DS)
+#endif
+
+// index of each dataset in the table (DS_IDX_ARDUEYE_ID_RAW...) and number of datasets
+#define DS_ENUM(Id, Display, Name, Cache, Rows, Cols, Divisor) DS_IDX_##Id,
+enum { ARDUEYE_DATASETS(DS_ENUM) MAX_DATASETS };
+
+// index of dataset DSID in the table, NULL_DS if none, worked out by the compiler
+#define DS_MATCH(Id, Display, Name, Cache, Rows, Cols, Divisor) (DSID == (Id)) ? (int)DS_IDX_##Id :
+template<int DSID> struct DataSetIndex { enum { Value = ARDUEYE_DATASETS(DS_MATCH) NULL_DS }; };
+
+// link settings used by begin() and setLinkConfig()
+typedef struct ArduEyeConfig{
+  
+  long Baud;        // serial baud rate
+  int SPIDivider;   // SPI_CLOCK_DIVx
+  int SPIMode;      // SPI_MODEx
+  
+  ArduEyeConfig()
+  {
+    Baud = 115200;
+    SPIDivider = SPI_CLOCK_DIV8;
+    SPIMode = SPI_MODE3;
+  }
+} ArduEyeConfig;
+
+// dataset handler: receives Size bytes of dataset DataSet starting at (Row, Col)
+typedef void (*DataSetHandler)(char DataSet, char *Data, int Size, int Row, int Col);
+
+// DSDescriptor: fixed settings of a dataset, from the dataset table
+typedef struct DSDescriptor{
+  
+  char DSID;
+  char DisplayType;
+  const char *Name;
+  boolean CacheHeader;
+  // expected size, until the first header is read
+  unsigned char Rows, Cols;
+  // default rate (see setDataSetRate)
+  unsigned char Divisor;
+} DSDescriptor;
+
 // DSRecord structure keeps track of dataset display types and
 // active/inactive status
 typedef struct DSRecord{
@@ -91,22 +258,71 @@ typedef struct DSRecord{
   int DSID;
   int DisplayType;
   char * name;
+  // function receiving the dataset as it is read (0 if none)
+  DataSetHandler Handler;
+  // previous frame for COMPRESS_FRAME: buffer, its size, bytes stored
+  char * Ref;
+  int RefMax, RefSize;
+  // part of the dataset sent to the UI (see setROI)
+  int ROIRow, ROICol, ROIRows, ROICols, ROIStep;
+  // scheduling (see setDataSetRate): read every Divisor frames, priority, 
+  // frames since last read, bytes sent to the UI last time
+  int Divisor, Priority, Skipped;
+  unsigned int LastSize;
+  // header cache (see readFrameHeader): size only changes with resolution commands,
+  // last header read (from byte 1) and reads in a row that returned it
+  boolean CacheHeader;
+  unsigned char Header[DS_HEAD_SIZE];
+  int HeaderReads;
+  // header (from byte 1) and display type last sent to the UI (display type -1 if none, see HEADER_CMD)
+  unsigned char SentHeader[DS_HEAD_SIZE];
+  int SentDisplay;
+#ifdef ARDUEYE_PROFILE
+  // performance counters (see getProfile)
+  unsigned long Prof[PROF_FIELDS];
+#endif
   
   DSRecord()
   {
     Active = false;
     DSID = NULL_DS;
     DisplayType = DISPLAY_NONE;
+    name = 0;
+    Handler = 0;
+    Ref = 0;
+    RefMax = RefSize = 0;
+    ROIRow = ROICol = ROIRows = ROICols = 0;
+    ROIStep = 1;
+    Divisor = 1;
+    Priority = Skipped = 0;
+    LastSize = 0;
+    CacheHeader = false;
+    HeaderReads = 0;
+    SentDisplay = -1;
+#ifdef ARDUEYE_PROFILE
+    for(int i = 0; i < PROF_FIELDS; i++)
+      Prof[i] = 0;
+#endif
   }
 } DSRecord;
 
+class ArduEyeBus;
+
 // main ArduEye class
 class ArduEye{
+    friend class ArduEyeBus;
 
 public:
 	ArduEye();
     // intialization function : must be called in the setup loop to start the ArduEye library
 	void begin(int RdyPin, int CSPin);
+    // same with custom serial baud rate and SPI settings (the ArduEye and UI must match them)
+    void begin(int RdyPin, int CSPin, const ArduEyeConfig &Config);
+    // change the serial and SPI settings
+    void setLinkConfig(const ArduEyeConfig &Config);
+    // measure serial and SPI bytes/sec with the current settings, SPI test reads one frame of DataSet
+    // returns false if no valid frame was read
+    boolean linkTest(char DataSet, unsigned long *SPIRate, unsigned long *SerialRate);
     
     ///////// ArduEye Data Acquire Functions //////////////////////////
     
@@ -121,10 +337,53 @@ public:
     // process the received data sets on the arduino instead of just passing
     // data directly to the UI)
     // Buf has a maximum size of MAX_SPI_PCKT_SIZE.  If the dataset is larger than this, Buf will contain a partial datse
-	void getDataSet(char DataSet, char *Buf);
+    // Nothing is read while a read of this sensor, or of another on its ArduEyeBus, holds chip select low
+	void getDataSet(char DataSet, char *Buf = 0);
+    // Acquire a whole dataset into Buf (BufSize bytes), whatever its size.  Rows and Cols are set to
+    // the dataset size.  Returns the number of bytes stored, 0 if none or if Buf is too small
+    int getDataSet(char DataSet, char *Buf, int BufSize, int *Rows, int *Cols);
+    // Stream a dataset to a handler function as it is read, one SPI packet at a time, 
+    // instead of (or as well as) copying it to Buf.  Used by getData(), getDataSet() and poll()
+    void setDataSetHandler(char DataSet, DataSetHandler Handler);
+    // Give a buffer of Size bytes to keep the last frame of DataSet (ARDUEYE_ID_RAW or ARDUEYE_ID_OF), 
+    // so compressed serial output can send the difference from the previous frame
+    void setReferenceBuffer(char DataSet, char *Buf, int Size);
+    // Send only a Rows x Cols window of DataSet starting at (Row, Col), every Step-th row and column, 
+    // to the UI.  Rows, Cols = 0 go to the edge of the dataset.  On board processing still gets the whole dataset
+    void setROI(char DataSet, int Row, int Col, int Rows, int Cols, int Step);
+    // Read DataSet every Divisor frames in getData() and poll().  Priority orders datasets due on the same frame
+    void setDataSetRate(char DataSet, int Divisor, int Priority);
+    // Limit the dataset bytes sent per frame, lower priority datasets that do not fit wait (0 = no limit)
+    void setFrameBudget(unsigned int Bytes);
+    // Read the headers and payloads of all datasets of a frame with a single request (SOF_CHAR) in 
+    // getData() and poll().  The ArduEye firmware must support it, otherwise per-dataset requests are used
+    void setFrameRequest(boolean Enable);
+    // Read each POLL_CHUNK_SIZE chunk of a payload in poll() with its own request (SOD_CHAR, then SOC_CHAR), so
+    // chip select is raised between calls.  The ArduEye firmware must support SOC_CHAR.  Frame requests still
+    // keep chip select low for the whole frame
+    void setChunkRequest(boolean Enable);
+    // Read each frame into Buf (Size bytes) and send END_FRAME before forwarding and processing it, so the
+    // ArduEye captures the next frame meanwhile.  Buf holds a header and payload per dataset (0 to turn off)
+    void setFrameBuffer(char *Buf, int Size);
+    // Ask the ArduEye for CRC trailers of Width bits (CRC_NONE, CRC_16 or CRC_32) after each header and
+    // CRC_CHUNK_SIZE bytes of payload.  Chunks failing the check are requested again on their own
+    void setCRC(char Width);
+    // headers and chunks that failed their CRC check
+    unsigned long crcErrors();
+    // CRC of Size bytes of Data continued from CRC (CRC_INIT for a new one), Width CRC_16 or CRC_32
+    static unsigned long crcUpdate(unsigned long CRC, const char *Data, int Size, char Width);
     // when used embedded dataset acquire, endFrame must be called each loop after all datasets have been read
     // endFrame alerts the ArduEye that data read is finished, and alerts the serial UI (if active)
     void endFrame();
+    
+    // Non-blocking data streaming: call poll() each loop instead of dataRdy() and getData().
+    // Each call does a bounded amount of work and returns true when a frame is complete.
+    // Chip select stays low and the SPI link in read mode between calls until a payload is read
+    // (unless setChunkRequest is on), or until the frame is read with setFrameRequest.  Other SPI
+    // devices must not be used meanwhile: with frame requests, not until frameActive() is false
+    boolean poll();
+    // true while poll() is in the middle of a frame
+    boolean frameActive();
 
 	////////// ArduEye settings /////////////////////////
     
@@ -140,7 +399,7 @@ public:
     // Set Display Type associate with a particular dataset.  This type will be used in Tx to the UI
     // The UI reads the Display Type variable to know how to display data
     void setDisplayType(int DSID, int DisplayType);
-    // find display type setting for a given dataset
+    // index of the settings of a given dataset, -1 if it is not in the dataset table
     int getDataIndex(char DataSet);
     
     ///////// Communications Functions ///////////////
@@ -149,11 +408,39 @@ public:
     boolean dataRdy();
     // check that sensor is booted and ready to receive commands
     boolean sensorRdy();
+    
+    // Data ready interrupt mode: a rising edge on the data ready pin flags a pending frame
+    // and records its micros() time.  dataRdy() and poll() then check the flag instead of the pin.
+    // Returns false if the data ready pin has no interrupt (see ArduEyePlatform.h)
+    boolean enableDataRdyInterrupt(boolean Enable);
+    // micros() time of the last data ready edge (interrupt mode only)
+    unsigned long frameTime();
+    // time between the last two frames, and the average deviation from the average
+    // frame interval (jitter), in microseconds (interrupt mode only)
+    unsigned long frameInterval();
+    unsigned long frameJitter();
+    // data ready interrupt handler
+    static void dataRdyISR();
+    
+    // Performance counters (ARDUEYE_PROFILE, see ArduEyePlatform.h): total of Field (PROF_COUNT ...)
+    // for DataSet since the last reset, or for all frames with ARDUEYE_ID_PROFILE.  0 when not compiled in
+    unsigned long getProfile(char DataSet, int Field);
+    // the same for the last frame completed by getData() or poll()
+    unsigned long getFrameProfile(int Field);
+    void resetProfile();
 
 	
     // check if serial data has been received from the UI
 	bool checkUIData();
+    // state of the serial link to the UI, one of LINK_OFF, LINK_OK, LINK_WAITING, LINK_LOST
+    int linkStatus();
+    // queue a byte received from the UI, for a serial receive interrupt handler feeding the library
+    // directly.  checkUIData() decodes it.  Returns false if the queue is full
+    boolean receiveUIByte(char Data);
 	
+    // ID of the sensor on its ArduEyeBus (tag of its serial packets), -1 if not on a bus
+    char sensorID();
+    
     // turn serial transmit on or off. Serial Tx is off by default
 	void enableSerialTx(boolean Enable);
     // turn serial monitor on or off, if on, serial data will be formated to be displayed
@@ -165,16 +452,131 @@ public:
     
 private:
     //FUNCTIONS
+    // set up the pins and dataset table (begin() without the link setup)
+    void beginSensor(int RdyPin, int CSPin);
     // check is serial buffer is clear and OK to send data
     boolean checkBufferFull();
+    // request a header or dataset, leaving the SPI link in read mode
+    void requestPacket(char Type, char DataSet);
+    // end a header or dataset read
+    void closePacket();
+    // true while this sensor, or another on its bus, has chip select low for a read
+    boolean spiBusy();
+    // send the command held while the SPI bus was busy
+    void sendHeldCmd();
+    // read a dataset header, returns the dataset size
+    int readHeader(char DataSet, unsigned char *Header);
+    // read a dataset payload (forwarding it via serial), last packet goes to Buf
+    // (or the whole dataset to Frame if given)
+    void readDataSet(int DSIdx, char DataSet, unsigned char *Header, char *Buf, char *Frame = 0);
+    // read the payload from an open request
+    void readPayload(int DSIdx, char DataSet, unsigned char *Header, char *Buf, char *Frame = 0);
+    // request a payload from byte Idx on, leaving the SPI link in read mode
+    void requestResume(char DataSet, int Idx);
+    void readPollChunk(char *Data, int Size);
+    // read payload bytes, checking and requesting again the chunks that fail their CRC
+    boolean readChunk(char DataSet, int Idx, char *Data, int Size);
+    // read a CRC trailer from the ArduEye and compare it with CRC
+    boolean checkCRC(unsigned long CRC);
+    // request the datasets in _FrameSets, leaving the SPI link in read mode
+    void requestFrame();
+    // read the next header of the frame request, or request it alone (or use the cached header)
+    int readFrameHeader(int DSIdx, unsigned char *Header);
+    // read the scheduled datasets into the frame buffer, returns the number stored
+    int readFrameBuffer();
+    // forward a dataset held in memory to the handler and via serial
+    void forwardPayload(int DSIdx, unsigned char *Header, char *Data);
+    // drop cached headers after a command that changes dataset sizes
+    void invalidateHeaders(char Cmd);
+    // false if the UI already has this header (see HEADER_CMD)
+    boolean headerChanged(int DSIdx, unsigned char *Header);
+    // pass a packet of dataset data to its handler
+    void handleData(int DSIdx, char DataSet, char *Data, int Size, int Idx, int Cols);
+    // stop a one time dataset request
+    void clearTemporaryDataSet();
+    // pick the datasets read this frame
+    void scheduleFrame();
+    void updateSize(int DSIdx, unsigned char *Header);
+    
+    // blocking serial output of dataset packets
+    void sendHeader(int DSIdx, unsigned char *Header);
+    void sendDataStart(int DSIdx, unsigned char *Header);
+    void sendData(const char *Buf, int Size);
+    void sendDataEnd(int DSIdx);
+    
+    // serial output staging
+    void stageByte(char Data);
+    // stage the start of a packet (tagged with the sensor ID on a bus)
+    void stagePacketStart();
+    // stage a byte of packet content, counted in the CRC of the packet
+    void stageContent(char Data);
+    // stage the CRC trailer of the packet
+    void stageCRC();
+    // stage the CRC trailer and the end of the packet
+    void stagePacketEnd();
+    void stageHeader(int DSIdx, unsigned char *Header);
+    void stageDataStart(int DSIdx, unsigned char *Header);
+    void stageDataEnd(int DSIdx);
+    void stageEndFrame();
+    void stageData(const char *Buf, int Size);
+    boolean flushSerial(boolean Block);
+    // escape staged payload into an output block, returns bytes written
+    int encodeData(char *Out, int OutSize);
+    // region of interest selection of the payload sent to the UI
+    boolean windowROI(int DSIdx, unsigned char *Header, int *Row, int *Col, int *Rows, int *Cols);
+    void forwardHeader(int DSIdx, unsigned char *Header, unsigned char *Out);
+    void startROI(int DSIdx, unsigned char *Header);
+    boolean selectROI();
+    void nextROI();
+    // wait for Size bytes of serial credit, false on timeout
+    boolean waitCredit(int Size);
+    // the UI did not answer in time: stop serial output until it does
+    void linkLost();
+    // flushSerial without the profiling
+    boolean writeSerial(boolean Block);
+    // ESC Code to the UI (CMD_ACK or GO_CHAR), held while a packet is going out
+    void sendControl(char Code);
+    void sendHeldControl();
+    
+    // performance counters: add Value to Field of the current dataset and frame, end a frame,
+    // header and payload of ARDUEYE_ID_PROFILE
+    void profileAdd(int Field, unsigned long Value);
+    void profileFrameEnd();
+    int profileHeader(unsigned char *Header);
+    void profileData(int Idx, char *Data, int Size);
+    
+    // data ready interrupt: record a new frame
+    void latchFrame();
+    
+    // poll() state changes
+    void startFlush(int Next);
+    void startPing(int Next);
+    // decode a byte received from the UI, returns true for an ACK_CHAR
+    boolean decodeUIByte(char Data);
+    void storeCmdByte(char Data);
     // parse cmd received from the UI and send to ArduEye
-    void parseCmd(int StartIdx, int EndIdx);
+    void parseCmd(char *cmd, int Size);
+    // carry out a parsed command (without the CMD_ACK)
+    void execCmd(char *cmd, int Size);
+    // take over the serial link state of another sensor on the bus
+    void takeLink(ArduEye &From);
     
     //DATA ARRAYS
-    // data from spi is stored in _ReceiveBuffer
-    char _ReceiveBuffer[MAX_SPI_PCKT_SIZE];
-    // data from serial port is stored in _InBuffer
-    char _InBuffer[MAX_IN_SERIAL];
+    // data from spi is stored in _ReceiveBuffer (MAX_SPI_PCKT_SIZE bytes) within a call, shared
+    // by the sensors started with begin() or lent by their ArduEyeBus
+    char *_ReceiveBuffer;
+    // chunk read by poll(), staged for the serial port until a later call
+    char _PollBuf[POLL_CHUNK_SIZE];
+    // bytes queued by receiveUIByte, written at _RxHead and read at _RxTail
+    volatile char _RxRing[RX_RING_SIZE];
+    volatile unsigned char _RxHead, _RxTail;
+    volatile boolean _RxOverflow;
+    // sensor whose queue checkUIData() reads: this one, or the first sensor of its ArduEyeBus
+    ArduEye *_RxQueue;
+    // command packet being decoded (_CmdLen is -1 outside a packet, 
+    // MAX_CMD_SIZE + 1 once the packet is too long)
+    char _CmdBuf[MAX_CMD_SIZE];
+    int _CmdLen;
     
     //DATASET TRACKING
 	DSRecord _DS[MAX_DATASETS];
@@ -182,6 +584,14 @@ private:
     char _ActiveSets[MAX_DATASETS];
         // number of active sets
     int _NumActiveSets;
+        // sets read this frame (see scheduleFrame), byte budget per frame and budget saved
+    unsigned char _FrameSets[MAX_DATASETS];
+    int _NumFrameSets;
+    unsigned int _FrameBudget;
+    long _BudgetLeft;
+        // frame buffer (see setFrameBuffer): buffer, its size, datasets stored and bytes used
+    char *_FrameBuf;
+    int _FrameBufSize, _BufSets, _BufUsed;
 	// Flag to process single request dataset
 	int _TemporaryDataSet;
     
@@ -192,10 +602,101 @@ private:
     
     // serial comm flags
 	boolean _SerialTx;
+    // serial and SPI settings
+    ArduEyeConfig _Config;
 	boolean _SerialMonitorMode;
     
-    // tracking variables for parsing serial input
-    int _InSIdx, _ESCReceived, _InBufIdx, _BufEnd;
+    // an ESC_CHAR was the last byte received from the UI
+    boolean _RxEsc;
+    
+    // data ready interrupt state: frame pending flag, last pin level,
+    // frame timestamp, last interval, average interval and jitter (us)
+    boolean _RdyInterrupt;
+    volatile boolean _FramePending, _RdyLevel;
+    volatile unsigned long _FrameTime, _FrameInterval, _IntervalAvg, _JitterAvg;
+    volatile unsigned int _FrameCount;
+    // instances using the data ready interrupt
+    static ArduEye *_RdySensors[MAX_SENSORS];
+    
+    // bus shared with other sensors (0 if none) and ID on it (-1 if none)
+    ArduEyeBus *_Bus;
+    char _SensorID;
+    
+    // set when an ACK_CHAR is received from the UI
+    boolean _AckReceived;
+    // the UI stopped answering (see linkLost), it answered since, time of the last ping sent to it
+    boolean _LinkLost, _LinkBack;
+    unsigned long _LinkTime;
+    
+    // credit flow control: enabled by the UI with CREDIT_CMD, bytes the UI can still take, window
+    boolean _CreditMode;
+    long _Credit, _CreditWindow;
+    
+    // true while chip select is low for a header or dataset read
+    boolean _SPIOpen;
+    // frame requests enabled, and true while the reply to one is being read
+    boolean _FrameRequest, _FrameOpen;
+    // poll() requests each payload chunk on its own (see setChunkRequest)
+    boolean _ChunkRequest;
+    // command held while a read is in progress (cmd byte + values)
+    char _HeldCmd[MAX_CMD_SIZE + 1];
+    int _HeldCmdSize;
+    
+    // staged serial output
+    // a packet has been started and not ended, CMD_ACKs and GO_CHAR held until it ends
+    boolean _TxPacket;
+    unsigned char _HeldAcks;
+    boolean _HeldPing;
+    char _TxBuf[TX_BUF_SIZE];
+    int _TxLen, _TxIdx;
+    const char *_TxData;
+    int _TxDataLen, _TxDataIdx;
+    char _TxPend[TX_PEND_SIZE];
+    int _TxPendLen, _TxPendIdx;
+    
+    // CRC trailers: width on SPI packets (see setCRC), headers and chunks that failed the check,
+    // width on serial packets (see CRC_CMD) and CRC of the packet being staged
+    char _CRCMode;
+    unsigned long _CRCErrors;
+    char _SerialCRC;
+    // width requested by CRC_CMD (-1 if none), applied after the first END_FRAME packet
+    // staged once its CMD_ACK has been sent
+    char _NextCRC;
+    boolean _NextCRCAcked;
+    unsigned long _TxCRC;
+    
+    // headers sent to the UI only when they change, tagged with SOH_CHAR (see HEADER_CMD)
+    boolean _HeaderChange;
+    
+    // serial compression: mode allowed by the UI, mode of the current packet,
+    // reference and store for the previous frame, previous byte, zero run, byte index
+    int _Compression, _CmpMode;
+    char *_CmpRef, *_CmpStore;
+    char _CmpPrev;
+    int _CmpRun, _CmpIdx;
+    
+    // region of interest of the current packet: active, position of the next payload byte,
+    // dataset cols, window and step
+    boolean _TxROI;
+    int _TxRow, _TxCol, _TxCols;
+    int _ROIRow, _ROICol, _ROIRows, _ROICols, _ROIStep;
+    
+    // poll() state: current state, state after a flush or ack, 
+    // dataset being read (index in _DS and in _FrameSets), its size and read index,
+    // frame read into the frame buffer first
+    int _AcqState, _AcqNext, _AckNext;
+    boolean _AcqBuffered;
+    int _AcqDS, _AcqSet, _AcqSize, _AcqIdx;
+    unsigned char _AcqHeader[FULL_HEAD_SIZE];
+    unsigned long _AckTime;
+    
+#ifdef ARDUEYE_PROFILE
+    // performance counters: dataset counted (index in _DS, -1 if none), time the frame and the
+    // last ping started, counters of the current frame, the last one and all frames
+    int _ProfDS;
+    unsigned long _ProfStart, _ProfPing;
+    unsigned long _ProfFrame[PROF_FIELDS], _ProfLast[PROF_FIELDS], _ProfTotal[PROF_FIELDS];
+#endif
 		
 };
 
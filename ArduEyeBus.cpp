@@ -0,0 +1,353 @@
+/*
+  ArduEyeBus.cpp - several ArduEye sensors on one SPI bus and serial link
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyeBus.h"
+
+/*---------------------------------------------------
+ ArduEyeBus: Constructor
+ ---------------------------------------------------*/
+ArduEyeBus::ArduEyeBus()
+{
+    _NumSensors = 0;
+    _Current = NULL_CHAR;
+    _Next = 0;
+    _Target = NULL_CHAR;
+    _HeldSize = NULL_CHAR;
+    _HeldTarget = NULL_CHAR;
+}
+
+/*---------------------------------------------------
+ attach: add a sensor to the bus and set up its pins and
+ datasets (as ArduEye::begin does, without the links)
+ Input:   Sensor: the sensor
+          RdyPin: its DataReady pin
+          CSPin: its ChipSelect pin
+ returns: the sensor ID, -1 if the bus is full
+ ---------------------------------------------------*/
+int ArduEyeBus::attach(ArduEye &Sensor, int RdyPin, int CSPin)
+{
+    int ID = _NumSensors;
+    
+    if(ID >= MAX_SENSORS)
+        return NULL_CHAR;
+    
+    _Sensors[ID] = &Sensor;
+    _NumSensors++;
+    Sensor._Bus = this;
+    Sensor._SensorID = ID;
+    Sensor._ReceiveBuffer = _ReceiveBuffer;
+    // bytes from receiveUIByte are queued in the first sensor
+    Sensor._RxQueue = _Sensors[0];
+    Sensor.beginSensor(RdyPin, CSPin);
+    
+    // the first sensor holds the serial link
+    if(_Current < 0)
+        _Current = ID;
+    return ID;
+}
+
+/*---------------------------------------------------
+ begin: set up the serial and SPI links, once for all 
+ the sensors attached
+ Input:   Config: link settings (see ArduEyeConfig)
+ ---------------------------------------------------*/
+void ArduEyeBus::begin()
+{
+    begin(ArduEyeConfig());
+}
+
+void ArduEyeBus::begin(const ArduEyeConfig &Config)
+{
+    int i;
+    
+    if(_NumSensors == 0)
+        return;
+    _Sensors[_Current]->setLinkConfig(Config);
+    for(i = 0; i < _NumSensors; i++)
+        _Sensors[i]->_Config = Config;
+}
+
+/*---------------------------------------------------
+ sensor: sensor with a given ID
+ returns: the sensor, 0 if ID is out of range
+ ---------------------------------------------------*/
+ArduEye *ArduEyeBus::sensor(int ID)
+{
+    if(ID < 0 || ID >= _NumSensors)
+        return 0;
+    return _Sensors[ID];
+}
+
+/*---------------------------------------------------
+ enableSerialTx, setSerialMonitorMode, enableDataRdyInterrupt:
+ the ArduEye settings, for every sensor on the bus
+ ---------------------------------------------------*/
+void ArduEyeBus::enableSerialTx(boolean Enable)
+{
+    for(int i = 0; i < _NumSensors; i++)
+        _Sensors[i]->enableSerialTx(Enable);
+}
+
+void ArduEyeBus::setSerialMonitorMode(boolean Enable)
+{
+    for(int i = 0; i < _NumSensors; i++)
+        _Sensors[i]->setSerialMonitorMode(Enable);
+}
+
+boolean ArduEyeBus::enableDataRdyInterrupt(boolean Enable)
+{
+    boolean Ok = true;
+    
+    for(int i = 0; i < _NumSensors; i++)
+        if(!_Sensors[i]->enableDataRdyInterrupt(Enable))
+            Ok = false;
+    return Ok;
+}
+
+/*---------------------------------------------------
+ selectSensor: choose the sensor that receives the UI
+ commands for datasets and the ArduEye.  Commands for the
+ serial link always go to the sensor holding it
+ Input:   ID: sensor ID, -1 (or out of range) for all sensors
+ ---------------------------------------------------*/
+void ArduEyeBus::selectSensor(int ID)
+{
+    _Target = (ID >= 0 && ID < _NumSensors) ? ID : NULL_CHAR;
+}
+
+/*---------------------------------------------------
+ dataRdy: check the data ready flags of all sensors
+ returns: true if a sensor has a frame ready
+ ---------------------------------------------------*/
+boolean ArduEyeBus::dataRdy()
+{
+    for(int i = 0; i < _NumSensors; i++)
+        if(_Sensors[i]->dataRdy())
+            return true;
+    return false;
+}
+
+/*---------------------------------------------------
+ nextReady: pick the next sensor to service among those 
+ with a frame ready.  Sensors using the data ready interrupt
+ go in the order of their data ready edges, others in 
+ turn, starting after the last sensor picked
+ returns: the sensor ID, -1 if no frame is ready
+ ---------------------------------------------------*/
+int ArduEyeBus::nextReady()
+{
+    int i, n, Best = NULL_CHAR;
+    ArduEye *Sensor;
+    
+    for(n = 0; n < _NumSensors; n++)
+    {
+        i = (_Next + n) % _NumSensors;
+        Sensor = _Sensors[i];
+        if(!Sensor->dataRdy())
+            continue;
+        if(!Sensor->_RdyInterrupt)
+        {
+            Best = i;
+            break;
+        }
+        if(Best < 0 || (long)(Sensor->frameTime() - _Sensors[Best]->frameTime()) < 0)
+            Best = i;
+    }
+    if(Best >= 0)
+        _Next = (Best + 1) % _NumSensors;
+    return Best;
+}
+
+/*---------------------------------------------------
+ service: give the serial link to a sensor before it reads
+ a frame.  Called between frames, when the staged serial
+ output of the sensor holding the link has been sent
+ Input:   ID: sensor ID
+ ---------------------------------------------------*/
+void ArduEyeBus::service(int ID)
+{
+    if(ID == _Current)
+        return;
+    _Sensors[ID]->takeLink(*_Sensors[_Current]);
+    _Current = ID;
+}
+
+/*---------------------------------------------------
+ getData: read the active datasets of the next sensor with
+ a frame ready and send them to the UI (see ArduEye::getData).
+ Call it each loop, it returns at once if no frame is ready
+ returns: ID of the sensor read, -1 if none was ready
+ ---------------------------------------------------*/
+int ArduEyeBus::getData()
+{
+    int ID;
+    
+    releaseCmd();
+    ID = nextReady();
+    if(ID < 0)
+        return NULL_CHAR;
+    service(ID);
+    _Sensors[ID]->getData();
+    return ID;
+}
+
+/*---------------------------------------------------
+ poll: non-blocking getData (see ArduEye::poll).  The frame
+ of the current sensor is finished before the next ready
+ sensor gets the bus
+ returns: ID of the sensor whose frame the call completed, 
+          -1 otherwise
+ ---------------------------------------------------*/
+int ArduEyeBus::poll()
+{
+    int ID = _Current;
+    
+    if(ID < 0)
+        return NULL_CHAR;
+    if(!_Sensors[ID]->frameActive())
+    {
+        releaseCmd();
+        ID = nextReady();
+        if(ID < 0)
+            return NULL_CHAR;
+        service(ID);
+    }
+    return _Sensors[ID]->poll() ? ID : NULL_CHAR;
+}
+
+/*---------------------------------------------------
+ checkUIData, receiveUIByte: bytes from the UI, decoded by
+ the sensor holding the serial link (see ArduEye)
+ ---------------------------------------------------*/
+bool ArduEyeBus::checkUIData()
+{
+    bool AckReceived;
+    
+    if(_Current < 0)
+        return false;
+    AckReceived = _Sensors[_Current]->checkUIData();
+    releaseCmd();
+    return AckReceived;
+}
+
+boolean ArduEyeBus::receiveUIByte(char Data)
+{
+    if(_NumSensors == 0)
+        return false;
+    return _Sensors[0]->receiveUIByte(Data);
+}
+
+/*---------------------------------------------------
+ route: pass a UI command to the sensor(s) it is for.
+ SENSOR_CMD selects the target sensor (cmd[1], -1 for all).
+ Serial link commands stay with the sensor holding the link.
+ Commands for other sensors that arrive while a read is in
+ progress are held until the bus is free (one command can be
+ held, further commands are dropped)
+ Input:   From: sensor that received the command
+          Cmd: command packet (MAX_CMD_SIZE bytes)
+          Size: length of the packet
+ returns: true if the bus handled the command, false if 
+          From should carry it out
+ ---------------------------------------------------*/
+boolean ArduEyeBus::route(ArduEye *From, char *Cmd, int Size)
+{
+    int i;
+    
+    switch(Cmd[0])
+    {
+        case SENSOR_CMD:
+            selectSensor(Cmd[1]);
+            return true;
+        // settings of the serial link, passed on by takeLink
+        case SERIAL_START:
+        case CREDIT_CMD:
+        case COMPRESS_CMD:
+        case HEADER_CMD:
+        case CRC_CMD:
+            return false;
+        default:
+            break;
+    }
+    
+    if(_Target == From->_SensorID)
+        return false;
+    if(busy())
+    {
+        if(_HeldSize < 0)
+        {
+            for(i = 0; i < MAX_CMD_SIZE; i++)
+                _HeldCmd[i] = Cmd[i];
+            _HeldSize = Size;
+            _HeldTarget = _Target;
+        }
+        return true;
+    }
+    execCmd(_Target, Cmd, Size);
+    return true;
+}
+
+// true while a sensor has chip select low for a read
+boolean ArduEyeBus::busy()
+{
+    for(int i = 0; i < _NumSensors; i++)
+        if(_Sensors[i]->_SPIOpen)
+            return true;
+    return false;
+}
+
+// send the commands held by route() and by the sensors once no read is in progress
+void ArduEyeBus::releaseCmd()
+{
+    int i, Size = _HeldSize;
+    
+    if(busy())
+        return;
+    for(i = 0; i < _NumSensors; i++)
+        _Sensors[i]->sendHeldCmd();
+    if(Size < 0)
+        return;
+    _HeldSize = NULL_CHAR;
+    execCmd(_HeldTarget, _HeldCmd, Size);
+}
+
+// run a UI command on sensor Target, or on all sensors if Target is -1
+void ArduEyeBus::execCmd(int Target, char *Cmd, int Size)
+{
+    if(Target >= 0)
+    {
+        _Sensors[Target]->execCmd(Cmd, Size);
+        return;
+    }
+    for(int i = 0; i < _NumSensors; i++)
+        _Sensors[i]->execCmd(Cmd, Size);
+}
@@ -0,0 +1,135 @@
+/*
+  ArduEyeBus.h - several ArduEye sensors on one SPI bus and serial link
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ ArduEyeBus runs several ArduEye sensors (stereo, several directions of
+ optic flow...) from one Arduino.  The sensors share the SPI bus, each
+ with its own data ready and chip select pins, and the serial link to
+ the UI.  The bus
+   - sets up the serial and SPI links once for all the sensors
+   - services the sensors in the order their frames become ready
+     (oldest data ready edge first in interrupt mode, round robin otherwise)
+   - tags the packets each sensor sends to the UI with SOS_CHAR sensor_id,
+     so the UI can tell the sensors apart
+   - passes the commands from the UI to the sensor selected with 
+     SENSOR_CMD, or to all of them
+ The sensor being serviced holds the serial link (flow control, credit, 
+ command decoding); its link state moves to the next sensor serviced. 
+ The sensors also share the bus's MAX_SPI_PCKT_SIZE byte SPI receive
+ buffer, lent to the sensor being serviced for its blocking reads (poll()
+ keeps its chunk in the sensor), so each sensor only adds its own state
+ (dataset table, serial staging and command buffers).  Declared as
+ globals, the bus and the sensors show in the .data and .bss sizes that
+ avr-size reports for the sketch's .elf file.
+ Use the bus functions below rather than begin(), dataRdy(), getData(), 
+ poll() and checkUIData() of the sensors.  The other functions of a
+ sensor (setDisplayType, startDataStream, getDataSet...) can be called
+ directly only while poll() is not in the middle of a read: chip select
+ stays low between calls until a payload or frame request is read (see
+ ArduEye::setChunkRequest).  Meanwhile a sensor holds its commands until
+ the read ends (one per sensor) and getDataSet() returns without reading
+*/
+
+#ifndef ARDUEYE_BUS_H
+#define ARDUEYE_BUS_H
+
+#include "ArduEye.h"
+
+class ArduEyeBus{
+    friend class ArduEye;
+
+public:
+    ArduEyeBus();
+    
+    // add Sensor to the bus, returns its sensor ID (the order of the calls, 
+    // from 0) or -1 if MAX_SENSORS are attached.  Attach the sensors, then call begin()
+    int attach(ArduEye &Sensor, int RdyPin, int CSPin);
+    // set up the serial and SPI links for all attached sensors
+    void begin();
+    void begin(const ArduEyeConfig &Config);
+    
+    // number of sensors and sensor ID (0 if ID is out of range)
+    int sensors() { return _NumSensors; }
+    ArduEye *sensor(int ID);
+    
+    // serial output and serial monitor format for all sensors (see ArduEye)
+    void enableSerialTx(boolean Enable);
+    void setSerialMonitorMode(boolean Enable);
+    // data ready interrupt for all sensors, returns false if a pin has no interrupt
+    boolean enableDataRdyInterrupt(boolean Enable);
+    
+    // sensor that receives the UI commands (as SENSOR_CMD does), -1 for all sensors
+    void selectSensor(int ID);
+    int selectedSensor() { return _Target; }
+    
+    // true if a sensor has a frame ready
+    boolean dataRdy();
+    // read the active datasets of the next ready sensor (blocking, see ArduEye::getData)
+    // returns: its ID, -1 if no sensor was ready
+    int getData();
+    // non-blocking: finish the frame of the current sensor one poll() at a time, 
+    // then move on to the next ready sensor.  returns: the ID of the sensor whose 
+    // frame the call completed, -1 otherwise
+    int poll();
+    
+    // process the bytes from the UI (see ArduEye::checkUIData)
+    bool checkUIData();
+    // queue a byte from the UI received in an interrupt (see ArduEye::receiveUIByte)
+    boolean receiveUIByte(char Data);
+    
+private:
+    // called by the sensor holding the link for each UI command: 
+    // returns true if the bus handled it
+    boolean route(ArduEye *From, char *Cmd, int Size);
+    // next sensor with a frame ready, -1 if none
+    int nextReady();
+    // give the serial link to sensor ID
+    void service(int ID);
+    // true while a sensor has an SPI read open
+    boolean busy();
+    // send the commands held while the bus was busy
+    void releaseCmd();
+    // run a command on the target sensor(s)
+    void execCmd(int Target, char *Cmd, int Size);
+    
+    ArduEye *_Sensors[MAX_SENSORS];
+    int _NumSensors;
+    // sensor holding the link, next sensor for round robin, target of UI commands
+    int _Current, _Next, _Target;
+    // command held while the bus is busy, its size (-1 if none) and target
+    char _HeldCmd[MAX_CMD_SIZE];
+    int _HeldSize, _HeldTarget;
+    // SPI receive buffer lent to the sensor being serviced
+    char _ReceiveBuffer[MAX_SPI_PCKT_SIZE];
+};
+
+#endif
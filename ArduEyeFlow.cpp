@@ -0,0 +1,189 @@
+/*
+  ArduEyeFlow.cpp - optic flow post-processing for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyeFlow.h"
+
+// 2^14 / n for n = 0..FLOW_MAX_VECTORS (0 and 1 unused), for the means
+static const unsigned int RecipTable[FLOW_MAX_VECTORS + 1] PROGMEM = {
+    16384, 16384, 8192, 5461, 4096, 3277, 2731, 2341,
+    2048, 1820, 1638, 1489, 1365, 1260, 1170, 1092,
+    1024, 964, 910, 862, 819, 780, 745, 712,
+    683, 655, 630, 607, 585, 565, 546, 529,
+    512, 496, 482, 468, 455, 443, 431, 420,
+    410, 400, 390, 381, 372, 364, 356, 349,
+    341, 334, 328, 321, 315, 309, 303, 298,
+    293, 287, 282, 278, 273, 269, 264, 260,
+    256
+};
+
+/*---------------------------------------------------
+ ArduEyeFlow: Constructor
+ ---------------------------------------------------*/
+ArduEyeFlow::ArduEyeFlow()
+{
+    _Shift = 2;
+    _Limit = 0;
+    reset();
+}
+
+/*---------------------------------------------------
+ reset: clear the smoothed vectors, the global flow and 
+ the odometry.  The next frame starts the filters
+ ---------------------------------------------------*/
+void ArduEyeFlow::reset()
+{
+    _Vectors = 0;
+    _FlowX = _FlowY = _Inliers = 0;
+    _OdoX = _OdoY = 0;
+}
+
+/*---------------------------------------------------
+ setSmoothing: set the IIR filter of the vectors
+ Input:   Shift: each frame moves the smoothed vectors 
+            1 / 2^Shift of the way to the new values
+            (0 to 7, 0 = no smoothing)
+ ---------------------------------------------------*/
+void ArduEyeFlow::setSmoothing(int Shift)
+{
+    _Shift = constrain(Shift, 0, 7);
+}
+
+/*---------------------------------------------------
+ setOutlierLimit: leave vectors that disagree with the 
+ rest of the frame out of the global flow
+ Input:   Limit: largest distance in x or y from the mean
+            of the frame, in OF units (0 = keep all)
+ ---------------------------------------------------*/
+void ArduEyeFlow::setOutlierLimit(int Limit)
+{
+    _Limit = (Limit > 0) ? ((long)Limit << FLOW_SHIFT) : 0;
+}
+
+// smoothed vector Idx, 0 if there is none
+int ArduEyeFlow::vectorX(int Idx)
+{
+    return (Idx >= 0 && Idx < _Vectors) ? _X[Idx] : 0;
+}
+
+int ArduEyeFlow::vectorY(int Idx)
+{
+    return (Idx >= 0 && Idx < _Vectors) ? _Y[Idx] : 0;
+}
+
+/*---------------------------------------------------
+ update: process a frame of the OF dataset.  Vectors past
+ FLOW_MAX_VECTORS are ignored.  A change in the number of
+ vectors (new OF resolution) restarts the filters
+ Input:   Data: x, y signed byte pairs (ARDUEYE_ID_OF)
+          Size: size of Data in bytes
+ ---------------------------------------------------*/
+void ArduEyeFlow::update(const char *Data, int Size)
+{
+    int i, Vectors = Size / 2;
+    
+    if(Vectors > FLOW_MAX_VECTORS)
+        Vectors = FLOW_MAX_VECTORS;
+    
+    // temporal smoothing, s += (x - s) / 2^Shift.  x - s spans 17 bits, 
+    // so the difference is taken in 32 bits (int is 16 bits on the AVR)
+    if(Vectors != _Vectors)
+    {
+        for(i = 0; i < Vectors; i++)
+        {
+            _X[i] = (int)(signed char)Data[2*i] * FLOW_ONE;
+            _Y[i] = (int)(signed char)Data[2*i + 1] * FLOW_ONE;
+        }
+        _Vectors = Vectors;
+    }
+    else
+    {
+        for(i = 0; i < Vectors; i++)
+        {
+            _X[i] += ((long)(signed char)Data[2*i] * FLOW_ONE - _X[i]) >> _Shift;
+            _Y[i] += ((long)(signed char)Data[2*i + 1] * FLOW_ONE - _Y[i]) >> _Shift;
+        }
+    }
+    
+    // global flow: mean of all vectors, then of those close to it
+    mean(0, 0, 0);
+    if(_Limit > 0)
+        mean(_FlowX, _FlowY, _Limit);
+    
+    // odometry
+    _OdoX += _FlowX;
+    _OdoY += _FlowY;
+}
+
+/*---------------------------------------------------
+ mean: average the smoothed vectors into _FlowX, _FlowY
+ and count them in _Inliers.  The sums are multiplied by
+ a reciprocal from RecipTable instead of divided
+ Input:   X, Y: center for the outlier test
+          Limit: largest distance from the center in x or y, 
+            0 to use all vectors
+ ---------------------------------------------------*/
+void ArduEyeFlow::mean(int X, int Y, long Limit)
+{
+    long SumX = 0, SumY = 0, DX, DY;
+    int i, n = 0;
+    long Recip;
+    
+    for(i = 0; i < _Vectors; i++)
+    {
+        if(Limit > 0)
+        {
+            DX = (long)_X[i] - X;
+            DY = (long)_Y[i] - Y;
+            if(DX > Limit || DX < -Limit || DY > Limit || DY < -Limit)
+                continue;
+        }
+        SumX += _X[i];
+        SumY += _Y[i];
+        n++;
+    }
+    
+    // all vectors rejected: keep the center
+    if(n == 0)
+    {
+        _FlowX = X;
+        _FlowY = Y;
+        _Inliers = 0;
+        return;
+    }
+    
+    // the sums are at most n * 2^15: scaled down 3 bits and multiplied
+    // by 2^14 / n they stay below 2^26
+    Recip = pgm_read_word(&RecipTable[n]);
+    _FlowX = ((SumX >> 3) * Recip) >> 11;
+    _FlowY = ((SumY >> 3) * Recip) >> 11;
+    _Inliers = n;
+}
@@ -0,0 +1,103 @@
+/*
+  ArduEyeFlow.h - optic flow post-processing for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ ArduEyeFlow processes the ARDUEYE_ID_OF dataset on the Arduino, so a
+ sketch can use the optic flow (or send a few numbers to a host) 
+ instead of shipping the whole grid over serial.  Each call to update()
+ takes one frame of the dataset (x, y signed byte pairs, as read by
+ getDataSet) and
+   - smooths every vector over time with a first order IIR filter
+   - rejects the vectors far from the mean of the frame
+   - averages the remaining vectors into a global flow
+   - integrates the global flow into a displacement (odometry)
+ All the math is 16/32 bit integer with shifts and a reciprocal table
+ instead of divisions, to suit the AVR.  Vectors and the global flow are
+ kept in 1/256 units of the OF dataset (FLOW_ONE = 1 OF unit)
+*/
+
+#ifndef ARDUEYE_FLOW_H
+#define ARDUEYE_FLOW_H
+
+#include "ArduEyePlatform.h"
+
+// most vectors processed per frame (16 bit x and y state each), the
+// largest OF grid of the sensor (8 x 16 bytes, 64 vectors)
+#define FLOW_MAX_VECTORS  64
+
+// fixed point scale of the results: one unit of the OF dataset
+#define FLOW_SHIFT  8
+#define FLOW_ONE    (1 << FLOW_SHIFT)
+
+class ArduEyeFlow{
+
+public:
+    ArduEyeFlow();
+    
+    // process a frame of the OF dataset: Size bytes, x and y of each vector
+    void update(const char *Data, int Size);
+    // clear the filters and the odometry
+    void reset();
+    
+    // IIR smoothing: each frame moves the vectors 1 / 2^Shift of the way to the
+    // new values (0 = no smoothing, default 2)
+    void setSmoothing(int Shift);
+    // vectors further than Limit OF units from the mean in x or y are left out of
+    // the global flow (0 = keep all vectors, default 0)
+    void setOutlierLimit(int Limit);
+    
+    // smoothed vector Idx, in 1/FLOW_ONE OF units
+    int vectorX(int Idx);
+    int vectorY(int Idx);
+    // global flow of the last frame, in 1/FLOW_ONE OF units
+    int flowX() { return _FlowX; }
+    int flowY() { return _FlowY; }
+    // vectors used for the global flow of the last frame
+    int inliers() { return _Inliers; }
+    // displacement since reset(), sum of the global flow of every frame, in OF units
+    long odometryX() { return _OdoX >> FLOW_SHIFT; }
+    long odometryY() { return _OdoY >> FLOW_SHIFT; }
+    
+private:
+    // global flow from the mean of the vectors, skipping those further than Limit from (X, Y) if Limit > 0
+    void mean(int X, int Y, long Limit);
+    
+    // smoothed vectors and their number
+    int _X[FLOW_MAX_VECTORS], _Y[FLOW_MAX_VECTORS];
+    int _Vectors;
+    int _Shift;
+    long _Limit;
+    int _FlowX, _FlowY, _Inliers;
+    long _OdoX, _OdoY;
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*
+  ArduEyeImage.cpp - raw image processing for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyeImage.h"
+
+/*---------------------------------------------------
+ ArduEyeImage: Constructor
+ ---------------------------------------------------*/
+ArduEyeImage::ArduEyeImage()
+{
+    _Kernel = IMAGE_KERNEL_NONE;
+    _Threshold = 128;
+    _Handler = 0;
+    _Binary = false;
+    _Rows = _Cols = 0;
+    startFrame();
+}
+
+/*---------------------------------------------------
+ setKernel: select the filter applied to the image
+ Input:   Kernel: IMAGE_KERNEL_NONE, IMAGE_KERNEL_BOX, 
+            IMAGE_KERNEL_GAUSS or IMAGE_KERNEL_SOBEL
+ ---------------------------------------------------*/
+void ArduEyeImage::setKernel(char Kernel)
+{
+    _Kernel = Kernel;
+}
+
+/*---------------------------------------------------
+ setThreshold: set the threshold of the count and centroid 
+ Input:   Threshold: filtered pixel value, 0 to 255 (pixels
+            strictly above it are counted)
+ ---------------------------------------------------*/
+void ArduEyeImage::setThreshold(int Threshold)
+{
+    _Threshold = constrain(Threshold, 0, 255);
+}
+
+/*---------------------------------------------------
+ setRowHandler: register a function to receive the filtered
+ image, one row at a time, as it is computed
+ Input:   Handler: function to call, or 0 to remove it
+          Binary: true to threshold the rows (255 above the
+            threshold, 0 otherwise)
+ ---------------------------------------------------*/
+void ArduEyeImage::setRowHandler(ImageRowHandler Handler, boolean Binary)
+{
+    _Handler = Handler;
+    _Binary = Binary;
+}
+
+/*---------------------------------------------------
+ setSize: set the size of the frames fed with push().
+ Rows are cut to IMAGE_MAX_COLS pixels (see cropped())
+ Input:   Rows, Cols: size of the raw dataset
+ ---------------------------------------------------*/
+void ArduEyeImage::setSize(int Rows, int Cols)
+{
+    _Rows = Rows;
+    _Cols = Cols;
+    startFrame();
+}
+
+/*---------------------------------------------------
+ processFrame: filter a whole frame and compute its features
+ Input:   Image: Rows x Cols pixels, row by row
+          Rows, Cols: size of the frame
+ ---------------------------------------------------*/
+void ArduEyeImage::processFrame(const char *Image, int Rows, int Cols)
+{
+    setSize(Rows, Cols);
+    push(Image, Rows * Cols, 0, 0);
+}
+
+/*---------------------------------------------------
+ push: take the next pixels of the frame.  Every completed
+ row lets the row above it be filtered, the last row 
+ finishes the frame.  Pixels out of sequence are dropped
+ and the frame restarts at the next (0, 0)
+ Input:   Data: Size pixels starting at (Row, Col)
+          Row, Col: position of Data[0] in the frame
+ ---------------------------------------------------*/
+void ArduEyeImage::push(const char *Data, int Size, int Row, int Col)
+{
+    int i, n;
+    unsigned char *Line;
+    
+    if(Row == 0 && Col == 0)
+        startFrame();
+    
+    // lost packet or frame already complete
+    if(_Cols <= 0 || Row != _InRow || Col != _InCol || _Done)
+        return;
+    
+    while(Size > 0 && _InRow < _Rows)
+    {
+        // copy up to the end of the row, the columns past IMAGE_MAX_COLS are skipped
+        n = _Cols - _InCol;
+        if(n > Size)
+            n = Size;
+        Line = _Lines[_InRow % 3];
+        for(i = 0; i < n && _InCol + i < IMAGE_MAX_COLS; i++)
+            Line[_InCol + i] = Data[i];
+        Data += n;
+        Size -= n;
+        _InCol += n;
+        
+        if(_InCol == _Cols)
+        {
+            // the row above now has both neighbours
+            if(_InRow > 0)
+                filterRow(_InRow - 1);
+            _InCol = 0;
+            _InRow++;
+            
+            if(_InRow == _Rows)
+            {
+                filterRow(_Rows - 1);
+                _Done = true;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------
+ centroid: divide a weighted position sum by the total weight
+ Input:   Sum: position sum (_SumRow or _SumCol)
+ returns: position in 1/256 pixels, -1 if no pixel was counted
+ ---------------------------------------------------*/
+long ArduEyeImage::centroid(unsigned long Sum)
+{
+    if(_SumWeight == 0)
+        return -1;
+    
+    // integer and fractional parts apart, Sum << 8 could overflow
+    return ((Sum / _SumWeight) << 8) + ((Sum % _SumWeight) << 8) / _SumWeight;
+}
+
+/*---------------------------------------------------
+ startFrame: clear the features for a new frame
+ ---------------------------------------------------*/
+void ArduEyeImage::startFrame()
+{
+    _InRow = _InCol = 0;
+    _Done = false;
+    _MaxValue = -1;
+    _MaxRow = _MaxCol = 0;
+    _Count = 0;
+    _SumWeight = _SumRow = _SumCol = 0;
+}
+
+/*---------------------------------------------------
+ filterRow: filter a row, update the features and pass
+ it to the row handler.  Rows Row - 1 to Row + 1 must be
+ in _Lines (the rows past the borders repeat the edge)
+ Input:   Row: row of the frame to filter
+ ---------------------------------------------------*/
+void ArduEyeImage::filterRow(int Row)
+{
+    unsigned char *Up = _Lines[(Row > 0 ? Row - 1 : Row) % 3];
+    unsigned char *Mid = _Lines[Row % 3];
+    unsigned char *Down = _Lines[(Row < _Rows - 1 ? Row + 1 : Row) % 3];
+    int Cols = _Cols < IMAGE_MAX_COLS ? _Cols : IMAGE_MAX_COLS;
+    int c, l, r, Gx, Gy, Value, Weight;
+    
+    for(c = 0; c < Cols; c++)
+    {
+        l = c > 0 ? c - 1 : c;
+        r = c < Cols - 1 ? c + 1 : c;
+        
+        switch(_Kernel)
+        {
+            case IMAGE_KERNEL_BOX:
+                // sum / 9 as sum * 57 / 512
+                Value = Up[l] + Up[c] + Up[r] + Mid[l] + Mid[c] + Mid[r] + 
+                    Down[l] + Down[c] + Down[r];
+                Value = ((long)Value * 57) >> 9;
+                break;
+            case IMAGE_KERNEL_GAUSS:
+                Value = (Up[l] + 2*Up[c] + Up[r] + 2*Mid[l] + 4*Mid[c] + 
+                    2*Mid[r] + Down[l] + 2*Down[c] + Down[r]) >> 4;
+                break;
+            case IMAGE_KERNEL_SOBEL:
+                Gx = (Up[r] + 2*Mid[r] + Down[r]) - (Up[l] + 2*Mid[l] + Down[l]);
+                Gy = (Down[l] + 2*Down[c] + Down[r]) - (Up[l] + 2*Up[c] + Up[r]);
+                Value = ((Gx < 0 ? -Gx : Gx) + (Gy < 0 ? -Gy : Gy)) >> 3;
+                if(Value > 255)
+                    Value = 255;
+                break;
+            default:
+                Value = Mid[c];
+                break;
+        }
+        
+        if(Value > _MaxValue)
+        {
+            _MaxValue = Value;
+            _MaxRow = Row;
+            _MaxCol = c;
+        }
+        
+        Weight = Value - _Threshold;
+        if(Weight > 0)
+        {
+            _Count++;
+            _SumWeight += Weight;
+            _SumRow += (unsigned long)Weight * Row;
+            _SumCol += (unsigned long)Weight * c;
+        }
+        
+        if(_Binary)
+            Value = Weight > 0 ? 255 : 0;
+        _Out[c] = Value;
+    }
+    
+    if(_Handler)
+        _Handler(Row, _Out, Cols);
+}
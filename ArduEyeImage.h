@@ -0,0 +1,127 @@
+/*
+  ArduEyeImage.h - raw image processing for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ ArduEyeImage processes the ARDUEYE_ID_RAW dataset on the Arduino, so a 
+ sketch can send or use a few features instead of whole frames.  Rows are
+ streamed through a 3 x 3 kernel as they arrive, so only three input rows
+ and one output row are kept in SRAM (4 * IMAGE_MAX_COLS bytes):
+   - kernel: none, 3 x 3 box blur, 3 x 3 Gaussian blur or Sobel gradient
+     magnitude, with the edge pixels repeated at the borders
+   - threshold: pixels of the filtered image above it are counted and 
+     their centroid, weighted by the excess over the threshold, computed
+   - the brightest pixel of the filtered image and its position
+ Filtered rows can also be passed to a function (setRowHandler), as is or
+ thresholded to 0 / 255.
+
+ Pixels come either from a whole frame in a buffer (processFrame, after
+ getDataSet(ARDUEYE_ID_RAW, Buf, Size, &Rows, &Cols)) or packet by packet 
+ from a DataSetHandler (setSize, then push() from the handler), in which 
+ case the frame never has to fit in SRAM
+*/
+
+#ifndef ARDUEYE_IMAGE_H
+#define ARDUEYE_IMAGE_H
+
+#include "ArduEyePlatform.h"
+
+// widest row kept (the full 112 pixel width of the raw image), columns 
+// past it are ignored, see cropped()
+#define IMAGE_MAX_COLS  112
+
+// kernels
+#define IMAGE_KERNEL_NONE   0   // pixels as is
+#define IMAGE_KERNEL_BOX    1   // mean of the 3 x 3 neighbourhood
+#define IMAGE_KERNEL_GAUSS  2   // 1 2 1 / 2 4 2 / 1 2 1 weights, / 16
+#define IMAGE_KERNEL_SOBEL  3   // (|Gx| + |Gy|) / 8 of the Sobel gradient
+
+// receives each filtered row of the frame
+typedef void (*ImageRowHandler)(int Row, unsigned char *Data, int Cols);
+
+class ArduEyeImage{
+
+public:
+    ArduEyeImage();
+    
+    // processing applied to the following frames
+    void setKernel(char Kernel);
+    void setThreshold(int Threshold);
+    void setRowHandler(ImageRowHandler Handler, boolean Binary = false);
+    
+    // process a whole frame of Rows x Cols pixels
+    void processFrame(const char *Image, int Rows, int Cols);
+    // size of the frames fed to push()
+    void setSize(int Rows, int Cols);
+    // feed Size pixels starting at (Row, Col), as given to a DataSetHandler.  
+    // (0, 0) starts a new frame
+    void push(const char *Data, int Size, int Row, int Col);
+    
+    // true once the last row of the frame has been processed
+    boolean done() { return _Done; }
+    // true if the frames are wider than IMAGE_MAX_COLS: the features only cover
+    // the first IMAGE_MAX_COLS columns
+    boolean cropped() { return _Cols > IMAGE_MAX_COLS; }
+    // results of the last frame
+    int maxValue() { return _MaxValue; }
+    int maxRow() { return _MaxRow; }
+    int maxCol() { return _MaxCol; }
+    // pixels above the threshold
+    unsigned int count() { return _Count; }
+    // centroid of the pixels above the threshold, in 1/256 pixels (-1 if none)
+    long centroidRow() { return centroid(_SumRow); }
+    long centroidCol() { return centroid(_SumCol); }
+    
+private:
+    void startFrame();
+    void filterRow(int Row);
+    long centroid(unsigned long Sum);
+    
+    // settings
+    char _Kernel;
+    int _Threshold;
+    ImageRowHandler _Handler;
+    boolean _Binary;
+    
+    // frame being received: size, next pixel, last 3 input rows
+    int _Rows, _Cols;
+    int _InRow, _InCol;
+    unsigned char _Lines[3][IMAGE_MAX_COLS];
+    unsigned char _Out[IMAGE_MAX_COLS];
+    boolean _Done;
+    
+    // features
+    int _MaxValue, _MaxRow, _MaxCol;
+    unsigned int _Count;
+    unsigned long _SumWeight, _SumRow, _SumCol;
+};
+
+#endif
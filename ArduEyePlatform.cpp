@@ -0,0 +1,194 @@
+/*
+  ArduEyePlatform.cpp - hardware access layer for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyePlatform.h"
+
+#if !defined(ARDUEYE_HOST) && (defined(__AVR_ATmega168__) || defined(__AVR_ATmega328P__)) && \
+    (defined(ARDUEYE_PCINT_ISR) || defined(ARDUEYE_PCINT_EXTERNAL))
+#define ARDUEYE_PCINT
+
+// handler for the data ready pin change interrupt
+static void (*RdyHandler)(void) = 0;
+#endif
+
+/*---------------------------------------------------
+ spiTransferBlock: transfer Size bytes over SPI
+ On the AVR the next byte is loaded into SPDR as soon as
+ the previous one has been shifted out, so there is no
+ call overhead between bytes
+ Input:   Out: bytes to send, or 0 to send 0x00
+          In: buffer for the received bytes, or 0
+          Size: number of bytes
+ ---------------------------------------------------*/
+void __attribute__((weak)) spiTransferBlock(const byte *Out, byte *In, int Size)
+{
+#if defined(__AVR__)
+    int i;
+    byte Data;
+    
+    if(Size <= 0)
+        return;
+    
+    SPDR = Out ? Out[0] : 0x00;
+    for(i = 1; i < Size; i++)
+    {
+        byte Next = Out ? Out[i] : 0x00;
+        while(!(SPSR & _BV(SPIF)));
+        Data = SPDR;
+        SPDR = Next;
+        if(In)
+            In[i - 1] = Data;
+    }
+    while(!(SPSR & _BV(SPIF)));
+    Data = SPDR;
+    if(In)
+        In[Size - 1] = Data;
+#elif defined(ARDUEYE_HOST)
+    SPI.transfer(Out, In, Size);
+#else
+    int i;
+    byte Data;
+    
+    for(i = 0; i < Size; i++)
+    {
+        Data = SPI.transfer(Out ? Out[i] : 0x00);
+        if(In)
+            In[i] = Data;
+    }
+#endif
+}
+
+#ifdef ARDUEYE_PCINT
+/*---------------------------------------------------
+ pcintRegister: pin change mask register and bit for an
+ ATmega168/328 pin.  Pins 0-7 are PCINT16-23 (PCIE2),
+ 8-13 are PCINT0-5 (PCIE0), 14-19 are PCINT8-13 (PCIE1)
+ returns: the PCMSK register or 0 if the pin has none
+ ---------------------------------------------------*/
+static volatile uint8_t *pcintRegister(int Pin, uint8_t *Bit, uint8_t *Group)
+{
+    if(Pin >= 0 && Pin <= 7)
+    {
+        *Bit = Pin;
+        *Group = PCIE2;
+        return &PCMSK2;
+    }
+    if(Pin >= 8 && Pin <= 13)
+    {
+        *Bit = Pin - 8;
+        *Group = PCIE0;
+        return &PCMSK0;
+    }
+    if(Pin >= 14 && Pin <= 19)
+    {
+        *Bit = Pin - 14;
+        *Group = PCIE1;
+        return &PCMSK1;
+    }
+    return 0;
+}
+#endif
+
+/*---------------------------------------------------
+ attachRdyInterrupt: run Handler when the data ready pin
+ changes level.  The handler checks the pin level itself
+ (pin change interrupts are shared by a whole port)
+ Input:   Pin: data ready pin
+          Handler: interrupt handler
+ returns: false if the pin has no usable interrupt
+ ---------------------------------------------------*/
+boolean attachRdyInterrupt(int Pin, void (*Handler)(void))
+{
+#if defined(ARDUEYE_HOST)
+    Host.attachPinInterrupt(Pin, Handler);
+    return true;
+#else
+    if(Pin == 2 || Pin == 3)
+    {
+        attachInterrupt(Pin - 2, Handler, CHANGE);
+        return true;
+    }
+#ifdef ARDUEYE_PCINT
+    uint8_t Bit, Group;
+    volatile uint8_t *Mask = pcintRegister(Pin, &Bit, &Group);
+    
+    if(Mask)
+    {
+        RdyHandler = Handler;
+        *Mask |= _BV(Bit);
+        PCICR |= _BV(Group);
+        return true;
+    }
+#endif
+    return false;
+#endif
+}
+
+void detachRdyInterrupt(int Pin)
+{
+#if defined(ARDUEYE_HOST)
+    Host.detachPinInterrupt(Pin);
+#else
+    if(Pin == 2 || Pin == 3)
+    {
+        detachInterrupt(Pin - 2);
+        return;
+    }
+#ifdef ARDUEYE_PCINT
+    uint8_t Bit, Group;
+    volatile uint8_t *Mask = pcintRegister(Pin, &Bit, &Group);
+    
+    if(Mask)
+        *Mask &= ~_BV(Bit);
+#endif
+#endif
+}
+
+#if defined(ARDUEYE_PCINT) && defined(ARDUEYE_PCINT_ISR)
+ISR(PCINT0_vect)
+{
+    if(RdyHandler)
+        RdyHandler();
+}
+
+ISR(PCINT1_vect)
+{
+    if(RdyHandler)
+        RdyHandler();
+}
+
+ISR(PCINT2_vect)
+{
+    if(RdyHandler)
+        RdyHandler();
+}
+#endif
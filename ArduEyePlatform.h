@@ -0,0 +1,95 @@
+/*
+  ArduEyePlatform.h - hardware access layer for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#ifndef ARDUEYE_PLATFORM_H
+#define ARDUEYE_PLATFORM_H
+
+// The ArduEye library talks to the hardware only through the Arduino core
+// API (SPI, Serial, digitalWrite/digitalRead, millis/micros, delay).
+// Defining ARDUEYE_HOST swaps the Arduino core for the host backend in
+// extras/host, which implements the same API on a PC against a simulated
+// ArduEye and a simulated clock.  This lets the library be run and
+// benchmarked off the board without any change to ArduEye.cpp
+#ifdef ARDUEYE_HOST
+#include "ArduEyeHost.h"
+#else
+#include <WProgram.h>
+#include <SPI.h>
+#include <avr/pgmspace.h>
+#endif
+
+// The data ready interrupt uses the external interrupts of pins 2 and 3.
+// Other pins need the pin change interrupts of the ATmega168/328, whose
+// PCINTx_vect handlers are often taken by other libraries (SoftwareSerial,
+// PinChangeInt...), so they are left alone unless one of the lines below 
+// is uncommented: ARDUEYE_PCINT_ISR to have the library define the three
+// PCINTx_vect handlers, ARDUEYE_PCINT_EXTERNAL if the sketch (or another
+// library) defines them and calls ArduEye::dataRdyISR() from them.  
+// Otherwise enableDataRdyInterrupt() returns false for those pins
+// #define ARDUEYE_PCINT_ISR
+// #define ARDUEYE_PCINT_EXTERNAL
+
+// Performance counters (see ArduEye::getProfile and ARDUEYE_ID_PROFILE):
+// time spent reading headers and payloads over SPI, forwarding them via
+// serial and waiting for the UI, bytes moved, dropped frames and ACK
+// timeouts, per dataset and per frame.  They take about 400 bytes of SRAM
+// and a micros() call around each step, so they are left out unless the
+// line below is uncommented (or ARDUEYE_PROFILE is defined when compiling)
+// #define ARDUEYE_PROFILE
+
+// Block SPI transfer: sends Size bytes from Out (0x00 if Out is null) and
+// stores the received bytes in In (discarded if In is null).  The default
+// version in ArduEyePlatform.cpp is a tight polled loop; it is declared
+// weak so boards with an SPI DMA engine can replace it by defining their
+// own spiTransferBlock() in the sketch
+void spiTransferBlock(const byte *Out, byte *In, int Size);
+
+// Call Handler when Pin changes level: external interrupt for pins 2 and 3,
+// pin change interrupt for other pins.  returns false if Pin has no interrupt
+boolean attachRdyInterrupt(int Pin, void (*Handler)(void));
+void detachRdyInterrupt(int Pin);
+
+// true if a byte can be written to the serial port without waiting
+static inline boolean serialTxReady()
+{
+#if defined(ARDUEYE_HOST)
+    return Host.serialTxReady();
+#elif defined(UDRE0)
+    return (UCSR0A & _BV(UDRE0)) != 0;
+#elif defined(UDRE)
+    return (UCSRA & _BV(UDRE)) != 0;
+#else
+    return true;
+#endif
+}
+
+#endif
@@ -38,20 +38,32 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // Comm Sizes
 #define FULL_HEAD_SIZE 6 
 
-// number of possible datasets
-#define MAX_DATASETS 6
-
-// data set ids
+// data set ids: even numbers, DS_ID_SLOTS of them from DS_ID_FIRST on
 #define ARDUEYE_ID_RAW 48
 #define ARDUEYE_ID_OF 50
 #define ARDUEYE_ID_FPS 54
 #define ARDUEYE_ID_CMD 56
 #define ARDUEYE_ID_MAXES 58
+#define DS_ID_FIRST 48
+#define DS_ID_SLOTS 8
+
+// datasets of the sensor, one DS() each: id, default display type, name printed
+// before it in serial monitor mode (0 if none), header cached (size only changes
+// with resolution commands), expected rows and cols, read every n frames.  
+// ArduEye.h builds the dataset table and the id to index map from this list
+#define SENSOR_DATASETS(DS) \
+    DS(ARDUEYE_ID_RAW,   DISPLAY_GRAYSCALE_IMAGE, 0,              true,  112, 112, 1) \
+    DS(ARDUEYE_ID_OF,    DISPLAY_CHARTS,          0,              true,  8,   16,  1) \
+    DS(ARDUEYE_ID_FPS,   DISPLAY_TEXT,            "FPS Sensor: ", false, 1,   2,   1) \
+    DS(ARDUEYE_ID_CMD,   DISPLAY_DUMP,            0,              false, 1,   4,   1) \
+    DS(ARDUEYE_ID_MAXES, DISPLAY_POINTS,          0,              false, 1,   2,   1)
 
 // ArduEye Commands
 #define CMD_CALIBRATE 70
 #define CMD_RESOLUTION 71
 #define CMD_OF_RESOLUTION 72
 #define CMD_OF_SMOOTHING 73
+// CRC trailers on SPI replies: width (CRC_NONE, CRC_16 or CRC_32, see ArduEye.h)
+#define CMD_CRC 74
 
 #endif
\ No newline at end of file
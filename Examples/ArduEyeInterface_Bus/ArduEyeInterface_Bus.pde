@@ -0,0 +1,53 @@
+/*
+ArduEye Interface Example using the ArduEye library.
+
+The ArduEye library implements an interface to the ArduEye Sensor using 
+a 5 wire interface (SPI + a DataReady wire)
+The SPI pins are defined in the SPI library ( MOSI: 11, MISO: 12, SCK: 13)
+
+This example streams two ArduEye sensors (e.g. a stereo pair) to the UI.  Both 
+sensors share the SPI pins, each has its own Chip Select and DataReady pins.
+The ArduEyeBus sets up the serial and SPI links once, reads the sensors in the
+order their frames become ready and tags each packet with the sensor ID, so the
+UI can show the sensors apart.  The UI selects the sensor its commands go to 
+with SENSOR_CMD (by default commands go to both sensors).
+
+*/
+
+#include "WProgram.h"
+#include <SPI.h>
+#include <ArduEye.h>
+#include <ArduEyeBus.h>
+
+ArduEyeBus bus;
+ArduEye leftEye;
+ArduEye rightEye;
+
+/// select pins for SPI chip select and DataReady of each sensor.  The ArduEye firmware
+/// of the second sensor must be adjusted to use its pins
+int leftDataReadyPin = 9;
+int leftChipSelectPin = 10;
+int rightDataReadyPin = 2;
+int rightChipSelectPin = 8;
+
+void setup()
+{
+  // attach the sensors (IDs 0 and 1), then begin sets up the links for both
+  bus.attach(leftEye, leftDataReadyPin, leftChipSelectPin);
+  bus.attach(rightEye, rightDataReadyPin, rightChipSelectPin);
+  bus.begin();
+  // enable Serial Tx for transmission to a UI
+  bus.enableSerialTx(true);
+  
+  leftEye.setDisplayType(ARDUEYE_ID_RAW, DISPLAY_GRAYSCALE_IMAGE);
+  rightEye.setDisplayType(ARDUEYE_ID_RAW, DISPLAY_GRAYSCALE_IMAGE);
+}
+
+void loop()
+{
+  // advance the frame acquisition of the sensors, one frame at a time
+  bus.poll();
+      
+  // check if any commands have come in from the UI and process   
+  bus.checkUIData();
+}
@@ -14,22 +14,27 @@ representation of the raw image and image processing data.  The UI can be activa
 is running to check and see what's happening, even while running in embedded mode.
 
 This example shows how one might interface with the ArduEye in embedded mode.  Setup commands and dataset calls are
-issued by the Arduino sketch as the UI is not connected. 
+issued by the Arduino sketch as the UI is not connected.  The optic flow is filtered and 
+integrated on the Arduino with ArduEyeFlow, giving the global flow and the displacement since
+the start (odometry).
 
 */
 
 #include "WProgram.h"
 #include <SPI.h>
 #include <ArduEye.h>
+#include <ArduEyeFlow.h>
 
 ArduEye arduEye;
+ArduEyeFlow flow;
 
 /// select pins for SPI chip select and DataReady.  These pins are defined on both the ARM and Arduino Pro Mini.  
 /// different pins can be used if desired but the ARM firmware must also be adjusted accordingly
 int dataReadyPin = 9;
 int chipSelectPin = 10;
 
-char OpticBuf[50];
+// room for the largest OF grid of the sensor (8 x 16 bytes)
+char OpticBuf[2*FLOW_MAX_VECTORS];
 char fps[2];
 
 
@@ -53,6 +58,11 @@ void setup()
   // set datasets to active, locally and on ArduEye
   arduEye.startDataStream(ARDUEYE_ID_OF);
   arduEye.startDataStream(ARDUEYE_ID_FPS);
+  
+  // smooth the optic flow over about 4 frames and leave out vectors more than 
+  // 8 units from the mean of the frame
+  flow.setSmoothing(2);
+  flow.setOutlierLimit(8);
 }
 
 void loop()
@@ -60,10 +70,17 @@ void loop()
   // check if ArduEye is ready to send data
   if(arduEye.dataRdy())
   {
+    int Rows, Cols;
+    
     // retrieve data from ArduEye and store in local arrays
-    arduEye.getDataSet(ARDUEYE_ID_OF, OpticBuf);
+    int Size = arduEye.getDataSet(ARDUEYE_ID_OF, OpticBuf, sizeof(OpticBuf), &Rows, &Cols);
     arduEye.getDataSet(ARDUEYE_ID_FPS, fps);
     
+    // filter the optic flow and update the odometry.  flow.flowX()/flowY() 
+    // (1/256 units) and flow.odometryX()/odometryY() can now drive the application
+    if(Size > 0)
+      flow.update(OpticBuf, Size);
+    
     // end Frame must be sent at the end of each frame to flag the ArduEye that data tx is over image capture can start
     arduEye.endFrame();
   }
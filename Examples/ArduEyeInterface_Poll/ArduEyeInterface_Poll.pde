@@ -0,0 +1,51 @@
+/*
+ArduEye Interface Example using the ArduEye library.
+
+The ArduEye library implements an interface to the ArduEye Sensor using 
+a 5 wire interface (SPI + a DataReady wire)
+The SPI pins are defined in the SPI library ( MOSI: 11, MISO: 12, SCK: 13)
+The Chip Select and Dataeady are defined by the ArduEye layout. (CS: 10, DataRdy: 9).  These
+pins can be changed but the ArduEye firmware must be updated as well.
+
+This example shows how to stream data to the UI without blocking the sketch loop.  
+getData() does not return until all active datasets have been read and sent via serial.
+poll() does a small amount of that work each call and returns immediately, so other
+tasks in loop() keep running at a steady rate while the frame is streamed.
+
+*/
+
+#include "WProgram.h"
+#include <SPI.h>
+#include <ArduEye.h>
+
+ArduEye arduEye;
+
+/// select pins for SPI chip select and DataReady.  These pins are defined on both the ARM and Arduino Pro Mini.  
+/// different pins can be used if desired but the ARM firmware must also be adjusted accordingly
+int dataReadyPin = 9;
+int chipSelectPin = 10;
+
+unsigned long frames = 0;
+
+void setup()
+{
+  // begin must be called to initilialize the ArduEye class
+  arduEye.begin(dataReadyPin, chipSelectPin);
+  // enable Serial Tx for transmission to a UI
+  arduEye.enableSerialTx(true);
+  
+  arduEye.setDisplayType(ARDUEYE_ID_RAW, DISPLAY_GRAYSCALE_IMAGE);
+}
+
+void loop()
+{
+  // advance the frame acquisition.  poll() checks the dataReadyPin itself
+  // and returns true when a frame has been completely sent
+  if(arduEye.poll())
+    frames++;
+      
+  // check if any commands have come in from the UI and process   
+  arduEye.checkUIData();
+  
+  // other time critical tasks can run here every loop
+}
@@ -0,0 +1,516 @@
+/*
+  ArduEyeHost.cpp - host (PC) backend for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyeHost.h"
+
+HostBoard Host;
+HostSerial Serial;
+HostSPI SPI;
+
+// number of pins tracked by the simulated board
+#define HOST_NUM_PINS 32
+
+static int PinState[HOST_NUM_PINS];
+
+// spi clock divider for each SPI_CLOCK_DIVx setting
+static const int SpiDividers[] = {4, 16, 64, 128, 2, 8, 32};
+
+/*---------------------------------------------------
+ HostBoard: simulated board, starts at cycle 0 with the
+ link settings used by ArduEye::begin()
+ ---------------------------------------------------*/
+HostBoard::HostBoard()
+{
+    _NumDevices = 0;
+    _NumIrqs = 0;
+    _Peer = 0;
+    _InIsr = false;
+    _IrqEnabled = true;
+    _SpiDivider = SPI_CLOCK_DIV8;
+    _Baud = 115200;
+    reset();
+}
+
+void HostBoard::reset()
+{
+    int i;
+    
+    _Cycles = 0;
+    _SerialFreeAt = 0;
+    _Selected = -1;
+    _RxHead = _RxTail = 0;
+    for(i = 0; i < _NumIrqs; i++)
+        _Irqs[i].Level = LOW;
+    
+    stats.SpiCalls = stats.SpiBytes = 0;
+    stats.SerialCalls = stats.SerialBytes = stats.SerialReads = 0;
+    stats.PinWrites = stats.PinReads = 0;
+    stats.DelayCycles = 0;
+    
+    for(i = 0; i < HOST_NUM_PINS; i++)
+        PinState[i] = LOW;
+}
+
+void HostBoard::attachDevice(HostSpiDevice *Device, int CSPin, int RdyPin)
+{
+    int i;
+    
+    // a device on the same chip select replaces the previous one
+    for(i = 0; i < _NumDevices; i++)
+        if(_Devices[i].CSPin == CSPin)
+            break;
+    if(i >= HOST_MAX_DEVICES)
+        return;
+    _Devices[i].Device = Device;
+    _Devices[i].CSPin = CSPin;
+    _Devices[i].RdyPin = RdyPin;
+    if(i == _NumDevices)
+        _NumDevices++;
+}
+
+void HostBoard::attachPeer(HostSerialPeer *Peer)
+{
+    _Peer = Peer;
+}
+
+/*---------------------------------------------------
+ attachPinInterrupt: call Handler on each level change of 
+ the data ready pin Pin (the pin of an attached device)
+ ---------------------------------------------------*/
+void HostBoard::attachPinInterrupt(int Pin, void (*Handler)(void))
+{
+    int i;
+    
+    for(i = 0; i < _NumIrqs; i++)
+        if(_Irqs[i].Pin == Pin)
+            break;
+    if(i == HOST_MAX_DEVICES)
+        return;
+    if(i == _NumIrqs)
+        _NumIrqs++;
+    _Irqs[i].Pin = Pin;
+    _Irqs[i].Handler = Handler;
+    _Irqs[i].Level = LOW;
+}
+
+void HostBoard::detachPinInterrupt(int Pin)
+{
+    int i;
+    
+    for(i = 0; i < _NumIrqs; i++)
+        if(_Irqs[i].Pin == Pin)
+            _Irqs[i].Handler = 0;
+}
+
+void HostBoard::enableInterrupts(bool Enable)
+{
+    _IrqEnabled = Enable;
+    if(Enable)
+        checkInterrupts();
+}
+
+/*---------------------------------------------------
+ checkInterrupts: run the handler of any pin interrupt 
+ whose data ready line has changed level (pin change
+ semantics).  For a rising edge the handler runs with the
+ clock set back to the edge, so micros() inside it reads 
+ the time the interrupt would have been taken; its own cost
+ is then added to the current time
+ ---------------------------------------------------*/
+void HostBoard::checkInterrupts()
+{
+    int i, d, Level;
+    uint64_t Edge, Now;
+    
+    if(_InIsr || !_IrqEnabled)
+        return;
+    
+    for(i = 0; i < _NumIrqs; i++)
+    {
+        if(!_Irqs[i].Handler)
+            continue;
+        for(d = 0; d < _NumDevices; d++)
+        {
+            if(_Devices[d].RdyPin != _Irqs[i].Pin)
+                continue;
+            Level = _Devices[d].Device->dataReady();
+            if(Level == _Irqs[i].Level)
+                continue;
+            _Irqs[i].Level = Level;
+            
+            Edge = _Devices[d].Device->risingEdge();
+            if(Level == LOW || Edge == HOST_NO_EDGE || Edge > _Cycles)
+                Edge = _Cycles;
+            
+            _InIsr = true;
+            Now = _Cycles;
+            _Cycles = Edge + HOST_CYCLES_ISR;
+            _Irqs[i].Handler();
+            _Cycles = Now + (_Cycles - Edge);
+            _InIsr = false;
+        }
+    }
+}
+
+/*---------------------------------------------------
+ pushRx: queue a byte sent by the UI.  As in HardwareSerial,
+ bytes are dropped when the receive buffer is full
+ ---------------------------------------------------*/
+void HostBoard::pushRx(byte Data)
+{
+    int Next = (_RxHead + 1) % HOST_RX_BUFFER_SIZE;
+    
+    if(Next == _RxTail)
+        return;
+    _Rx[_RxHead] = Data;
+    _RxHead = Next;
+}
+
+/*---------------------------------------------------
+ pinWrite: a chip select going low selects its device
+ ---------------------------------------------------*/
+void HostBoard::pinWrite(int Pin, int Value)
+{
+    int i;
+    
+    advance(HOST_CYCLES_PIN_IO);
+    stats.PinWrites++;
+    if(Pin < 0 || Pin >= HOST_NUM_PINS)
+        return;
+    PinState[Pin] = Value;
+    
+    for(i = 0; i < _NumDevices; i++)
+    {
+        if(_Devices[i].CSPin != Pin)
+            continue;
+        if(Value == LOW && _Selected != i)
+        {
+            _Selected = i;
+            _Devices[i].Device->select();
+        }
+        else if(Value == HIGH && _Selected == i)
+        {
+            _Selected = -1;
+            _Devices[i].Device->deselect();
+        }
+    }
+}
+
+int HostBoard::pinRead(int Pin)
+{
+    int i;
+    
+    advance(HOST_CYCLES_PIN_IO);
+    stats.PinReads++;
+    for(i = 0; i < _NumDevices; i++)
+    {
+        if(_Devices[i].RdyPin == Pin)
+            return _Devices[i].Device->dataReady();
+    }
+    if(Pin < 0 || Pin >= HOST_NUM_PINS)
+        return LOW;
+    return PinState[Pin];
+}
+
+/*---------------------------------------------------
+ spiTransfer: one byte takes 8 spi clocks plus the call
+ overhead.  MISO reads 0 when no device is selected
+ ---------------------------------------------------*/
+byte HostBoard::spiTransfer(byte Out)
+{
+    advance(HOST_CYCLES_SPI_CALL + 8 * SpiDividers[_SpiDivider]);
+    stats.SpiCalls++;
+    stats.SpiBytes++;
+    if(_Selected < 0)
+        return 0;
+    return _Devices[_Selected].Device->transfer(Out);
+}
+
+/*---------------------------------------------------
+ spiTransfer: block version, one call overhead and a short
+ gap between bytes while the loop reloads the data register
+ ---------------------------------------------------*/
+void HostBoard::spiTransfer(const byte *Out, byte *In, int Size)
+{
+    int i;
+    byte Data;
+    
+    if(Size <= 0)
+        return;
+    advance(HOST_CYCLES_SPI_BLOCK);
+    stats.SpiCalls++;
+    for(i = 0; i < Size; i++)
+    {
+        advance(HOST_CYCLES_SPI_GAP + 8 * SpiDividers[_SpiDivider]);
+        stats.SpiBytes++;
+        Data = _Selected < 0 ? 0 : _Devices[_Selected].Device->transfer(Out ? Out[i] : 0x00);
+        if(In)
+            In[i] = Data;
+    }
+}
+
+/*---------------------------------------------------
+ serialWrite: the 0022 core writes synchronously, so the
+ caller waits until the previous byte has left the UART
+ ---------------------------------------------------*/
+void HostBoard::serialWrite(byte Data)
+{
+    if(_Cycles < _SerialFreeAt)
+        advance(_SerialFreeAt - _Cycles);
+    // 10 bits per byte (start, 8 data, stop)
+    _SerialFreeAt = _Cycles + (10ULL * F_CPU) / _Baud;
+    stats.SerialBytes++;
+    if(_Peer)
+        _Peer->receive(Data);
+}
+
+int HostBoard::serialAvailable()
+{
+    advance(HOST_CYCLES_SERIAL_READ);
+    if(_Peer)
+        _Peer->poll();
+    return (HOST_RX_BUFFER_SIZE + _RxHead - _RxTail) % HOST_RX_BUFFER_SIZE;
+}
+
+int HostBoard::serialRead()
+{
+    int Data;
+    
+    advance(HOST_CYCLES_SERIAL_READ);
+    stats.SerialReads++;
+    if(_RxHead == _RxTail)
+        return -1;
+    Data = _Rx[_RxTail];
+    _RxTail = (_RxTail + 1) % HOST_RX_BUFFER_SIZE;
+    return Data;
+}
+
+/*---------------------------------------------------
+ Arduino core functions
+ ---------------------------------------------------*/
+void pinMode(int Pin, int Mode)
+{
+    Host.advance(HOST_CYCLES_PIN_IO);
+}
+
+void digitalWrite(int Pin, int Value)
+{
+    Host.pinWrite(Pin, Value);
+}
+
+int digitalRead(int Pin)
+{
+    return Host.pinRead(Pin);
+}
+
+unsigned long millis()
+{
+    Host.advance(HOST_CYCLES_MILLIS);
+    return (unsigned long)(Host.cycles() / (F_CPU / 1000));
+}
+
+unsigned long micros()
+{
+    Host.advance(HOST_CYCLES_MILLIS);
+    return (unsigned long)(Host.cycles() / (F_CPU / 1000000));
+}
+
+void noInterrupts()
+{
+    Host.enableInterrupts(false);
+}
+
+void interrupts()
+{
+    Host.enableInterrupts(true);
+}
+
+void delay(unsigned long Ms)
+{
+    uint64_t Cycles = (uint64_t)Ms * (F_CPU / 1000);
+    
+    Host.advance(Cycles);
+    Host.stats.DelayCycles += Cycles;
+}
+
+void delayMicroseconds(unsigned int Us)
+{
+    uint64_t Cycles = (uint64_t)Us * (F_CPU / 1000000);
+    
+    Host.advance(Cycles);
+    Host.stats.DelayCycles += Cycles;
+}
+
+/*---------------------------------------------------
+ HostSerial: every write call pays the call overhead,
+ every byte pays its wire time
+ ---------------------------------------------------*/
+void HostSerial::begin(long Baud)
+{
+    Host.setBaud(Baud);
+}
+
+int HostSerial::available()
+{
+    return Host.serialAvailable();
+}
+
+int HostSerial::read()
+{
+    return Host.serialRead();
+}
+
+void HostSerial::write(uint8_t Data)
+{
+    Host.advance(HOST_CYCLES_SERIAL_CALL);
+    Host.stats.SerialCalls++;
+    Host.serialWrite(Data);
+}
+
+void HostSerial::write(const uint8_t *Buf, size_t Size)
+{
+    Host.advance(HOST_CYCLES_SERIAL_CALL);
+    Host.stats.SerialCalls++;
+    while(Size--)
+        Host.serialWrite(*Buf++);
+}
+
+void HostSerial::printNumber(unsigned long Value, int Base)
+{
+    char Digits[8 * sizeof(long)];
+    int i = 0;
+    
+    if(Base < 2)
+        Base = 10;
+    do
+    {
+        Digits[i++] = "0123456789ABCDEF"[Value % Base];
+        Value /= Base;
+    } while(Value);
+    while(i > 0)
+        write(Digits[--i]);
+}
+
+void HostSerial::print(const char Str[])
+{
+    while(*Str)
+        write(*Str++);
+}
+
+void HostSerial::print(char Data, int Base)
+{
+    print((long)Data, Base);
+}
+
+void HostSerial::print(unsigned char Data, int Base)
+{
+    print((unsigned long)Data, Base);
+}
+
+void HostSerial::print(int Data, int Base)
+{
+    print((long)Data, Base);
+}
+
+void HostSerial::print(unsigned int Data, int Base)
+{
+    print((unsigned long)Data, Base);
+}
+
+void HostSerial::print(long Data, int Base)
+{
+    if(Base == BYTE)
+        write((uint8_t)Data);
+    else if(Base == DEC && Data < 0)
+    {
+        write('-');
+        printNumber(-Data, DEC);
+    }
+    else
+        printNumber(Data, Base);
+}
+
+void HostSerial::print(unsigned long Data, int Base)
+{
+    if(Base == BYTE)
+        write((uint8_t)Data);
+    else
+        printNumber(Data, Base);
+}
+
+void HostSerial::println()
+{
+    write('\r');
+    write('\n');
+}
+
+void HostSerial::println(const char Str[])
+{
+    print(Str);
+    println();
+}
+
+void HostSerial::println(char Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
+
+void HostSerial::println(unsigned char Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
+
+void HostSerial::println(int Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
+
+void HostSerial::println(unsigned int Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
+
+void HostSerial::println(long Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
+
+void HostSerial::println(unsigned long Data, int Base)
+{
+    print(Data, Base);
+    println();
+}
@@ -0,0 +1,295 @@
+/*
+  ArduEyeHost.h - host (PC) backend for the ArduEye library
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ The host backend implements the part of the Arduino core API that the
+ ArduEye library uses (SPI, Serial, pin io and timing) on a PC.  It is
+ selected by compiling the library with ARDUEYE_HOST defined, e.g.
+
+   g++ -DARDUEYE_HOST -I. -Iextras/host ArduEye.cpp ArduEyeBus.cpp ArduEyePlatform.cpp \
+       extras/host/ArduEyeHost.cpp app.cpp
+
+ Time is simulated: every SPI byte, serial byte, pin access and delay
+ advances a cycle counter (F_CPU cycles per second) by the cost it would
+ have on an ATmega328 running the Arduino core, so millis()/micros() and
+ the link statistics in HostBoard::Stats describe the board, not the PC.
+
+ The sensor side of the SPI bus is provided by a HostSpiDevice attached
+ to a chip select / data ready pin pair, and the UI side of the serial
+ link by a HostSerialPeer.  ArduEyeSim.h has simulations of both.
+*/
+
+#ifndef ARDUEYE_HOST_H
+#define ARDUEYE_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Arduino core types and constants used by the library
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW  0
+#define INPUT  0
+#define OUTPUT 1
+
+// Print formats (Arduino 0022: BYTE prints the raw character)
+#define BYTE 0
+#define BIN  2
+#define OCT  8
+#define DEC  10
+#define HEX  16
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+// tables kept in flash on the AVR are ordinary constants on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(addr))
+#define pgm_read_word(addr) (*(addr))
+#define pgm_read_dword(addr) (*(addr))
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+// SPI settings (values as in the Arduino SPI library)
+#define SPI_CLOCK_DIV4   0x00
+#define SPI_CLOCK_DIV16  0x01
+#define SPI_CLOCK_DIV64  0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2   0x04
+#define SPI_CLOCK_DIV8   0x05
+#define SPI_CLOCK_DIV32  0x06
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+// cost in cpu cycles of the core calls, measured on an ATmega328 with
+// the Arduino 0022 core.  The wire time of SPI and serial bytes is added
+// on top of these
+#define HOST_CYCLES_SPI_CALL     12
+#define HOST_CYCLES_SPI_BLOCK    30
+#define HOST_CYCLES_SPI_GAP      2
+#define HOST_CYCLES_SERIAL_CALL  40
+#define HOST_CYCLES_SERIAL_READ  30
+#define HOST_CYCLES_PIN_IO       50
+#define HOST_CYCLES_MILLIS       20
+#define HOST_CYCLES_REG_READ     4
+#define HOST_CYCLES_ISR          60
+
+// maximum number of devices on the simulated SPI bus
+#define HOST_MAX_DEVICES 4
+// risingEdge() value of a device whose data ready line has not risen yet
+#define HOST_NO_EDGE ((uint64_t)-1)
+// size of the simulated serial receive buffer (as in HardwareSerial)
+#define HOST_RX_BUFFER_SIZE 128
+
+// sensor side of the SPI bus
+class HostSpiDevice {
+public:
+    virtual ~HostSpiDevice() {}
+    // chip select lowered / raised
+    virtual void select() {}
+    virtual void deselect() {}
+    // exchange one byte; Out is the byte sent by the Arduino
+    virtual byte transfer(byte Out) = 0;
+    // level of the data ready pin at the current simulated time
+    virtual int dataReady() { return LOW; }
+    // cycle of the latest rising edge of the data ready pin, up to the
+    // current simulated time (HOST_NO_EDGE if none); gives the time at
+    // which a pin interrupt is taken
+    virtual uint64_t risingEdge() { return HOST_NO_EDGE; }
+};
+
+// UI side of the serial link
+class HostSerialPeer {
+public:
+    virtual ~HostSerialPeer() {}
+    // byte written by the Arduino
+    virtual void receive(byte Data) = 0;
+    // called whenever the Arduino checks for incoming data, so the peer
+    // can queue replies with HostBoard::pushRx()
+    virtual void poll() {}
+};
+
+// simulated board: clock, pins, attached devices and link statistics
+class HostBoard {
+public:
+    struct Stats {
+        unsigned long SpiCalls;
+        unsigned long SpiBytes;
+        unsigned long SerialCalls;
+        unsigned long SerialBytes;
+        unsigned long SerialReads;
+        unsigned long PinWrites;
+        unsigned long PinReads;
+        uint64_t DelayCycles;
+    };
+
+    HostBoard();
+    
+    // reset clock, statistics, pins and serial buffers (devices and link settings stay)
+    void reset();
+
+    // attach a device to the bus, selected by CSPin, signalling on RdyPin
+    // (replaces the device attached to CSPin, if any)
+    void attachDevice(HostSpiDevice *Device, int CSPin, int RdyPin);
+    void attachPeer(HostSerialPeer *Peer);
+
+    // simulated time
+    uint64_t cycles() const { return _Cycles; }
+    void advance(uint64_t Cycles) { _Cycles += Cycles; if(_NumIrqs) checkInterrupts(); }
+    // first cycle at which the serial transmitter is free again
+    uint64_t serialFreeAt() const { return _SerialFreeAt; }
+    // serial data register empty (costs a register read)
+    bool serialTxReady() { advance(HOST_CYCLES_REG_READ); return _Cycles >= _SerialFreeAt; }
+
+    // interrupt on a level change of a data ready pin
+    void attachPinInterrupt(int Pin, void (*Handler)(void));
+    void detachPinInterrupt(int Pin);
+    // global interrupt enable (noInterrupts()/interrupts())
+    void enableInterrupts(bool Enable);
+
+    // queue a byte from the UI to the Arduino
+    void pushRx(byte Data);
+
+    Stats stats;
+
+    // used by the core API below
+    void pinWrite(int Pin, int Value);
+    int pinRead(int Pin);
+    byte spiTransfer(byte Out);
+    void spiTransfer(const byte *Out, byte *In, int Size);
+    void serialWrite(byte Data);
+    int serialAvailable();
+    int serialRead();
+    void setSpiDivider(int Divider) { _SpiDivider = Divider; }
+    void setBaud(long Baud) { _Baud = Baud; }
+
+private:
+    struct Attachment {
+        HostSpiDevice *Device;
+        int CSPin;
+        int RdyPin;
+    };
+    Attachment _Devices[HOST_MAX_DEVICES];
+    int _NumDevices;
+    // index of the currently selected device, or -1
+    int _Selected;
+    HostSerialPeer *_Peer;
+    
+    struct PinIrq {
+        int Pin;
+        void (*Handler)(void);
+        // level the handler was last run for
+        int Level;
+    };
+    PinIrq _Irqs[HOST_MAX_DEVICES];
+    int _NumIrqs;
+    bool _InIsr, _IrqEnabled;
+    void checkInterrupts();
+
+    uint64_t _Cycles;
+    uint64_t _SerialFreeAt;
+    int _SpiDivider;
+    long _Baud;
+
+    byte _Rx[HOST_RX_BUFFER_SIZE];
+    int _RxHead, _RxTail;
+};
+
+extern HostBoard Host;
+
+// Arduino core API
+void pinMode(int Pin, int Mode);
+void digitalWrite(int Pin, int Value);
+int digitalRead(int Pin);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long Ms);
+void noInterrupts();
+void interrupts();
+void delayMicroseconds(unsigned int Us);
+
+// serial port (Print semantics of the Arduino 0022 core)
+class HostSerial {
+public:
+    void begin(long Baud);
+    int available();
+    int read();
+    void write(uint8_t Data);
+    void write(const uint8_t *Buf, size_t Size);
+
+    void print(const char Str[]);
+    void print(char Data, int Base = BYTE);
+    void print(unsigned char Data, int Base = BYTE);
+    void print(int Data, int Base = DEC);
+    void print(unsigned int Data, int Base = DEC);
+    void print(long Data, int Base = DEC);
+    void print(unsigned long Data, int Base = DEC);
+
+    void println();
+    void println(const char Str[]);
+    void println(char Data, int Base = BYTE);
+    void println(unsigned char Data, int Base = BYTE);
+    void println(int Data, int Base = DEC);
+    void println(unsigned int Data, int Base = DEC);
+    void println(long Data, int Base = DEC);
+    void println(unsigned long Data, int Base = DEC);
+
+private:
+    void printNumber(unsigned long Value, int Base);
+};
+
+// SPI master
+class HostSPI {
+public:
+    void begin() {}
+    void end() {}
+    void setBitOrder(int Order) {}
+    void setDataMode(int Mode) {}
+    void setClockDivider(int Divider) { Host.setSpiDivider(Divider); }
+    byte transfer(byte Data) { return Host.spiTransfer(Data); }
+    // block transfer with the timing of the polled loop in spiTransferBlock()
+    void transfer(const byte *Out, byte *In, int Size) { Host.spiTransfer(Out, In, Size); }
+};
+
+extern HostSerial Serial;
+extern HostSPI SPI;
+
+#endif
@@ -0,0 +1,725 @@
+/*
+  ArduEyeSim.cpp - host simulation of the ArduEye ARM firmware and the UI
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+#include "ArduEyeSim.h"
+#include <ArduEye.h>
+
+/*---------------------------------------------------
+ ArduEyeSim: simulated sensor, booted and with the first
+ frame ready at cycle 0
+ ---------------------------------------------------*/
+ArduEyeSim::ArduEyeSim()
+{
+    _Rows = _Cols = 16;
+    _OFRows = _OFCols = 4;
+    _Scene = SIM_SCENE_MOVING;
+    _FPS = 100;
+    _CRC = CRC_NONE;
+    _Noise = 0;
+    _NoiseSeed = 1;
+    _Esc = _InPacket = _ReadMode = false;
+    _OutIdx = 0;
+    _Frame = 0;
+    _ReadyAt = 0;
+    _PrevReadyAt = HOST_NO_EDGE;
+    resetStats();
+}
+
+void ArduEyeSim::resetStats()
+{
+    stats.Frames = stats.HeaderRequests = stats.DataRequests = stats.FrameRequests = 0;
+    stats.ResumeRequests = stats.CorruptBytes = 0;
+    stats.Commands = stats.PayloadBytes = 0;
+    stats.LatencyCycles = stats.MaxLatencyCycles = 0;
+}
+
+void ArduEyeSim::setFPS(unsigned int FPS)
+{
+    _FPS = FPS > 0 ? FPS : 1;
+}
+
+void ArduEyeSim::setResolution(int Rows, int Cols)
+{
+    _Rows = constrain(Rows, 1, SIM_MAX_RES);
+    _Cols = constrain(Cols, 1, SIM_MAX_RES);
+}
+
+void ArduEyeSim::setOFResolution(int Rows, int Cols)
+{
+    _OFRows = constrain(Rows, 1, SIM_MAX_RES);
+    _OFCols = constrain(Cols, 1, SIM_MAX_RES);
+}
+
+/*---------------------------------------------------
+ datasetSize: raw image is Rows x Cols pixels, optic flow
+ is OFRows x OFCols (x,y) pairs, FPS is a 2 byte value,
+ CMD dumps the 4 resolution settings and MAXES is the
+ (row, col) of the brightest pixel
+ ---------------------------------------------------*/
+void ArduEyeSim::datasetSize(int DSID, int &Rows, int &Cols) const
+{
+    switch(DSID)
+    {
+        case ARDUEYE_ID_RAW:
+            Rows = _Rows; Cols = _Cols;
+            break;
+        case ARDUEYE_ID_OF:
+            Rows = _OFRows; Cols = 2 * _OFCols;
+            break;
+        case ARDUEYE_ID_FPS:
+        case ARDUEYE_ID_MAXES:
+            Rows = 1; Cols = 2;
+            break;
+        case ARDUEYE_ID_CMD:
+            Rows = 1; Cols = 4;
+            break;
+        default:
+            Rows = Cols = 0;
+            break;
+    }
+}
+
+byte ArduEyeSim::datasetByte(int DSID, unsigned long Frame, int Idx) const
+{
+    unsigned long Seed;
+    
+    switch(DSID)
+    {
+        case ARDUEYE_ID_RAW:
+            switch(_Scene)
+            {
+                case SIM_SCENE_STATIC:
+                    return (byte)(Idx % _Cols + Idx / _Cols);
+                case SIM_SCENE_NOISE:
+                    Seed = (Frame * 2654435761UL) ^ (Idx * 40503UL);
+                    Seed ^= Seed >> 13;
+                    return (byte)(Seed * 2246822519UL >> 24);
+                case SIM_SCENE_ESC:
+                    return ESC_CHAR;
+                default:
+                    return (byte)(Idx % _Cols + Idx / _Cols + Frame);
+            }
+        case ARDUEYE_ID_OF:
+            // constant flow of one pixel per frame to the right
+            return (Idx & 1) ? 0 : 16;
+        case ARDUEYE_ID_FPS:
+            return Idx == 0 ? (byte)(_FPS >> 8) : (byte)_FPS;
+        case ARDUEYE_ID_CMD:
+            switch(Idx)
+            {
+                case 0: return _Rows;
+                case 1: return _Cols;
+                case 2: return _OFRows;
+                default: return _OFCols;
+            }
+        case ARDUEYE_ID_MAXES:
+            return Idx == 0 ? (byte)(Frame % _Rows) : (byte)(Frame % _Cols);
+        default:
+            return 0;
+    }
+}
+
+/*---------------------------------------------------
+ SPI interface: every transaction starts in write mode.
+ ESC_CHAR flags are parsed on the incoming bytes in either
+ mode; in read mode the prepared output is shifted out
+ ---------------------------------------------------*/
+void ArduEyeSim::select()
+{
+    _Esc = _InPacket = _ReadMode = false;
+}
+
+void ArduEyeSim::deselect()
+{
+    _ReadMode = false;
+}
+
+byte ArduEyeSim::transfer(byte Out)
+{
+    byte Reply = 0;
+    
+    if(_ReadMode && _OutIdx < _Out.size())
+    {
+        Reply = _Out[_OutIdx++];
+        // line noise: flip a pseudo random bit
+        if(_Noise)
+        {
+            _NoiseSeed = _NoiseSeed * 1103515245UL + 12345;
+            if((_NoiseSeed >> 8) % _Noise == 0)
+            {
+                Reply ^= 1 << ((_NoiseSeed >> 4) & 7);
+                stats.CorruptBytes++;
+            }
+        }
+    }
+    
+    if(_Esc)
+    {
+        _Esc = false;
+        switch(Out)
+        {
+            case WRITE_CHAR:
+                _ReadMode = false;
+                return Reply;
+            case READ_CHAR:
+                _ReadMode = true;
+                _OutIdx = 0;
+                return Reply;
+            case START_PCKT:
+                _InPacket = true;
+                _Packet.clear();
+                return Reply;
+            case END_PCKT:
+                _InPacket = false;
+                execute();
+                return Reply;
+            default:
+                // not a flag, the ESC_CHAR was data
+                if(_InPacket)
+                    _Packet.push_back(ESC_CHAR);
+                break;
+        }
+    }
+    else if(Out == ESC_CHAR && !_ReadMode)
+    {
+        _Esc = true;
+        return Reply;
+    }
+    
+    if(_InPacket && !_ReadMode)
+        _Packet.push_back(Out);
+    return Reply;
+}
+
+/*---------------------------------------------------
+ dataReady: high from the end of a capture until the
+ Arduino sends END_FRAME
+ ---------------------------------------------------*/
+int ArduEyeSim::dataReady()
+{
+    return Host.cycles() >= _ReadyAt ? HIGH : LOW;
+}
+
+uint64_t ArduEyeSim::risingEdge()
+{
+    return Host.cycles() >= _ReadyAt ? _ReadyAt : _PrevReadyAt;
+}
+
+void ArduEyeSim::execute()
+{
+    uint64_t Latency;
+    size_t Start = 0;
+    
+    if(_Packet.empty())
+        return;
+    
+    switch(_Packet[0])
+    {
+        case SOH_CHAR:
+            stats.HeaderRequests++;
+            if(_Packet.size() > 1)
+                prepareHeader(_Packet[1]);
+            return;
+        case SOD_CHAR:
+            stats.DataRequests++;
+            if(_Packet.size() > 1)
+                prepareData(_Packet[1]);
+            return;
+        case SOF_CHAR:
+            stats.FrameRequests++;
+            if(_Packet.size() > 1 && _Packet.size() >= (size_t)_Packet[1] + 2)
+                prepareFrame(&_Packet[2], _Packet[1]);
+            return;
+        case SOC_CHAR:
+            stats.ResumeRequests++;
+            if(_Packet.size() > 3)
+                prepareData(_Packet[1], (_Packet[2] << 8) + _Packet[3]);
+            return;
+        case END_FRAME:
+            // a new capture starts when the Arduino has read the frame
+            if(Host.cycles() >= _ReadyAt)
+            {
+                Latency = Host.cycles() - _ReadyAt;
+                stats.LatencyCycles += Latency;
+                if(Latency > stats.MaxLatencyCycles)
+                    stats.MaxLatencyCycles = Latency;
+                stats.Frames++;
+                _Frame++;
+                _PrevReadyAt = _ReadyAt;
+                _ReadyAt = Host.cycles() + F_CPU / _FPS;
+            }
+            return;
+        case WRITE_CMD:
+            // command forwarded from the UI
+            Start = 1;
+            break;
+        default:
+            break;
+    }
+    
+    stats.Commands++;
+    if(_Packet.size() < Start + 2)
+        return;
+    switch(_Packet[Start])
+    {
+        case CMD_RESOLUTION:
+            if(_Packet.size() >= Start + 3)
+                setResolution(_Packet[Start + 1], _Packet[Start + 2]);
+            break;
+        case CMD_OF_RESOLUTION:
+            if(_Packet.size() >= Start + 3)
+                setOFResolution(_Packet[Start + 1], _Packet[Start + 2]);
+            break;
+        case CMD_CRC:
+            _CRC = _Packet[Start + 1];
+            if(_CRC != CRC_16 && _CRC != CRC_32)
+                _CRC = CRC_NONE;
+            break;
+        default:
+            break;
+    }
+}
+
+void ArduEyeSim::prepareHeader(int DSID)
+{
+    int Rows, Cols;
+    
+    datasetSize(DSID, Rows, Cols);
+    _Out.resize(FULL_HEAD_SIZE);
+    _Out[0] = DSID;
+    _Out[1] = Rows >> 8;
+    _Out[2] = Rows & 0xFF;
+    _Out[3] = Cols >> 8;
+    _Out[4] = Cols & 0xFF;
+    _Out[5] = 0;
+    if(_CRC)
+        appendCRC(0);
+    _OutIdx = 0;
+}
+
+void ArduEyeSim::appendCRC(size_t Start)
+{
+    unsigned long CRC = ArduEye::crcUpdate(CRC_INIT, (const char *)&_Out[Start], 
+                                           _Out.size() - Start, _CRC);
+    
+    for(int i = _CRC / 8 - 1; i >= 0; i--)
+        _Out.push_back((byte)(CRC >> (8 * i)));
+}
+
+unsigned long ArduEyeSim::dataFrame(int DSID) const
+{
+    std::map<int, unsigned long>::const_iterator Frame = _DataFrames.find(DSID);
+    
+    return Frame == _DataFrames.end() ? 0 : Frame->second;
+}
+
+unsigned long ArduEyeSim::mismatches(int DSID, unsigned long Frame, const std::vector<byte> &Data,
+                                     int Row, int Col, int Rows, int Cols, int Step) const
+{
+    int InRows, InCols, r, c;
+    unsigned long Errors = 0;
+    size_t Idx = 0;
+    
+    // window clipped to the dataset, as ArduEye::windowROI
+    datasetSize(DSID, InRows, InCols);
+    Row = Row < InRows ? Row : InRows;
+    Col = Col < InCols ? Col : InCols;
+    if(Rows <= 0 || Rows > InRows - Row)
+        Rows = InRows - Row;
+    if(Cols <= 0 || Cols > InCols - Col)
+        Cols = InCols - Col;
+    if(Step < 1)
+        Step = 1;
+    
+    for(r = 0; r < Rows; r += Step)
+        for(c = 0; c < Cols; c += Step, Idx++)
+            if(Idx >= Data.size() || Data[Idx] != datasetByte(DSID, Frame, (Row + r) * InCols + Col + c))
+                Errors++;
+    if(Data.size() > Idx)
+        Errors += Data.size() - Idx;
+    return Errors;
+}
+
+// headers and payloads of Count datasets, one after the other
+void ArduEyeSim::prepareFrame(const byte *DSIDs, int Count)
+{
+    std::vector<byte> Reply;
+    int k;
+    
+    for(k = 0; k < Count; k++)
+    {
+        prepareHeader(DSIDs[k]);
+        Reply.insert(Reply.end(), _Out.begin(), _Out.end());
+        prepareData(DSIDs[k]);
+        Reply.insert(Reply.end(), _Out.begin(), _Out.end());
+    }
+    _Out.swap(Reply);
+    _OutIdx = 0;
+}
+
+// payload from byte Offset on, with a CRC trailer after every CRC_CHUNK_SIZE bytes
+void ArduEyeSim::prepareData(int DSID, int Offset)
+{
+    int Rows, Cols, i;
+    
+    datasetSize(DSID, Rows, Cols);
+    _DataFrames[DSID] = _Frame;
+    _Out.clear();
+    for(i = Offset; i < Rows * Cols; i++)
+    {
+        _Out.push_back(datasetByte(DSID, _Frame, i));
+        if(_CRC && ((i + 1) % CRC_CHUNK_SIZE == 0 || i + 1 == Rows * Cols))
+            appendCRC(_Out.size() - (i % CRC_CHUNK_SIZE + 1));
+    }
+    _OutIdx = 0;
+    if(Offset < Rows * Cols)
+        stats.PayloadBytes += Rows * Cols - Offset;
+}
+
+/*---------------------------------------------------
+ ArduEyeUISim: simulated UI, answers pings after 1 ms
+ ---------------------------------------------------*/
+ArduEyeDecoder::ArduEyeDecoder()
+{
+    reset();
+}
+
+void ArduEyeDecoder::reset()
+{
+    _Esc = _InPacket = false;
+    _Packet.clear();
+    _Last.clear();
+}
+
+int ArduEyeDecoder::feed(byte Data)
+{
+    if(_Esc)
+    {
+        _Esc = false;
+        switch(Data)
+        {
+            case START_PCKT:
+                _InPacket = true;
+                _Packet.clear();
+                return DECODE_NONE;
+            case END_PCKT:
+                if(!_InPacket)
+                    return DECODE_ERROR;
+                _InPacket = false;
+                _Last = _Packet;
+                return DECODE_PACKET;
+            case GO_CHAR:
+                return DECODE_GO;
+            case CMD_ACK:
+                return DECODE_CMD_ACK;
+            case ESC_CHAR:
+                // escaped data byte
+                break;
+            default:
+                return DECODE_ERROR;
+        }
+    }
+    else if(Data == ESC_CHAR)
+    {
+        _Esc = true;
+        return DECODE_NONE;
+    }
+    
+    if(!_InPacket)
+        return DECODE_ERROR;
+    _Packet.push_back(Data);
+    return DECODE_NONE;
+}
+
+bool ArduEyeDecoder::endFrame() const
+{
+    return _Last.size() == 1 && _Last[0] == END_FRAME;
+}
+
+ArduEyeUISim::ArduEyeUISim()
+{
+    _AckEnabled = true;
+    _CreditPending = _CreditActive = false;
+    _CreditWindow = 0;
+    _Consumed = 0;
+    _ExpectData = false;
+    _Compression = COMPRESS_NONE;
+    _HeaderPending = _HeaderTags = _HeaderEnable = false;
+    _CRCPending = _CRCAcked = false;
+    _CRCWidth = _CRC = CRC_NONE;
+    _Sensor = -1;
+    setAckLatency(1000);
+    resetStats();
+}
+
+void ArduEyeUISim::resetStats()
+{
+    stats.Bytes = stats.Packets = stats.Frames = 0;
+    stats.Pings = stats.CmdAcks = stats.Credits = stats.Errors = 0;
+    stats.PayloadBytes = stats.Headers = stats.CRCErrors = 0;
+    _DataPackets.clear();
+    _SensorFrames.clear();
+}
+
+void ArduEyeUISim::sendCommand(const byte *Data, int Size)
+{
+    int i;
+    
+    Host.pushRx(ESC_CHAR);
+    Host.pushRx(START_PCKT);
+    for(i = 0; i < Size; i++)
+    {
+        Host.pushRx(Data[i]);
+        // duplicated so it is not taken for an escape sequence
+        if(Data[i] == ESC_CHAR)
+            Host.pushRx(ESC_CHAR);
+    }
+    Host.pushRx(ESC_CHAR);
+    Host.pushRx(END_PCKT);
+}
+
+void ArduEyeUISim::enableCredit(int Window)
+{
+    byte Cmd[2] = {CREDIT_CMD, (byte)Window};
+    
+    sendCommand(Cmd, 2);
+    _CreditWindow = Window;
+    _CreditPending = true;
+}
+
+void ArduEyeUISim::enableCompression(int Mode)
+{
+    byte Cmd[2] = {COMPRESS_CMD, (byte)Mode};
+    
+    sendCommand(Cmd, 2);
+    _Compression = Mode;
+}
+
+void ArduEyeUISim::enableHeaderChange(bool Enable)
+{
+    byte Cmd[2] = {HEADER_CMD, (byte)Enable};
+    
+    sendCommand(Cmd, 2);
+    _HeaderEnable = Enable;
+    _HeaderPending = true;
+}
+
+void ArduEyeUISim::enableCRC(int Width)
+{
+    byte Cmd[2] = {CRC_CMD, (byte)Width};
+    
+    sendCommand(Cmd, 2);
+    _CRCWidth = Width;
+    _CRCPending = true;
+}
+
+/*---------------------------------------------------
+ decodeData: store the payload of a data packet, undoing
+ the compression described in ArduEye::encodeData()
+ ---------------------------------------------------*/
+void ArduEyeUISim::decodeData(const std::vector<byte> &Packet)
+{
+    int DSID = Packet[0];
+    int Mode = COMPRESS_NONE;
+    size_t i = 1, n, Idx;
+    byte Prev = 0, Value;
+    std::vector<byte> Ref;
+    std::vector<byte> &Out = _Data[key(DSID, _Sensor)];
+    const std::vector<byte> &Header = _Headers[key(DSID, _Sensor)];
+    
+    _DataPackets[key(DSID, _Sensor)]++;
+    // text display: cols, the payload, then the dataset name
+    if(Header.size() > FULL_HEAD_SIZE && Header[FULL_HEAD_SIZE] == DISPLAY_TEXT)
+    {
+        n = ((Header[1] << 8) + Header[2]) * ((Header[3] << 8) + Header[4]);
+        i = (n + 2 <= Packet.size()) ? 2 : Packet.size();
+        Out.assign(Packet.begin() + i, Packet.begin() + (i + n <= Packet.size() ? i + n : Packet.size()));
+        stats.PayloadBytes += Out.size();
+        return;
+    }
+    if(_Compression != COMPRESS_NONE && (DSID == ARDUEYE_ID_RAW || DSID == ARDUEYE_ID_OF) && 
+       Packet.size() > 1)
+        Mode = Packet[i++];
+    if(Mode == COMPRESS_NONE)
+    {
+        Out.assign(Packet.begin() + i, Packet.end());
+        stats.PayloadBytes += Out.size();
+        return;
+    }
+    
+    Ref.swap(Out);
+    while(i < Packet.size())
+    {
+        // zero run: 0, n
+        n = 1;
+        if(Packet[i] == 0 && i + 1 < Packet.size())
+        {
+            n = Packet[i + 1];
+            i += 2;
+            Value = 0;
+        }
+        else
+            Value = Packet[i++];
+        while(n--)
+        {
+            Idx = Out.size();
+            if(Mode == COMPRESS_FRAME)
+                Prev = (Idx < Ref.size() ? Ref[Idx] : 0);
+            Prev += Value;
+            Out.push_back(Prev);
+        }
+    }
+    stats.PayloadBytes += Out.size();
+}
+
+void ArduEyeUISim::receive(byte Data)
+{
+    stats.Bytes++;
+    
+    // credit is counted from the byte after the CMD_ACK of CREDIT_CMD
+    if(_CreditActive && ++_Consumed >= CREDIT_UNIT)
+    {
+        _Consumed -= CREDIT_UNIT;
+        if(_AckEnabled)
+            _CreditDue.push_back(Host.cycles() + _AckCycles);
+    }
+    
+    std::vector<byte> Packet;
+    unsigned long CRC, Trailer;
+    size_t i, Size;
+    
+    switch(_Decoder.feed(Data))
+    {
+        case DECODE_PACKET:
+            stats.Packets++;
+            Packet = _Decoder.packet();
+            // check and remove the CRC trailer, drop the packet if it does not match
+            if(_CRC != CRC_NONE)
+            {
+                Size = _CRC / 8;
+                if(Packet.size() < Size)
+                {
+                    stats.CRCErrors++;
+                    break;
+                }
+                Packet.resize(Packet.size() - Size);
+                CRC = ArduEye::crcUpdate(CRC_INIT, Packet.empty() ? 0 : (const char *)&Packet[0], 
+                                         Packet.size(), _CRC);
+                for(i = 0, Trailer = 0; i < Size; i++)
+                    Trailer = (Trailer << 8) | _Decoder.packet()[Packet.size() + i];
+                if(Trailer != CRC)
+                {
+                    stats.CRCErrors++;
+                    break;
+                }
+            }
+            // sensor tag of an ArduEyeBus
+            _Sensor = -1;
+            if(Packet.size() >= 2 && Packet[0] == SOS_CHAR)
+            {
+                _Sensor = Packet[1];
+                Packet.erase(Packet.begin(), Packet.begin() + 2);
+            }
+            if(Packet.size() == 1 && Packet[0] == END_FRAME)
+            {
+                stats.Frames++;
+                _SensorFrames[_Sensor]++;
+                // CRC_CMD acknowledged: the next packets carry the new trailer
+                if(_CRCAcked)
+                {
+                    _CRCAcked = false;
+                    _CRC = _CRCWidth;
+                }
+            }
+            else if(Packet.empty())
+                _ExpectData = !_ExpectData;
+            else if(_HeaderTags ? Packet[0] != SOH_CHAR : _ExpectData)
+            {
+                decodeData(Packet);
+                _ExpectData = false;
+            }
+            else
+            {
+                size_t Skip = _HeaderTags ? 1 : 0;
+                if(Packet.size() > Skip)
+                    _Headers[key(Packet[Skip], _Sensor)].assign(Packet.begin() + Skip, Packet.end());
+                stats.Headers++;
+                _ExpectData = true;
+            }
+            break;
+        case DECODE_GO:
+            stats.Pings++;
+            if(_AckEnabled)
+                _AckDue.push_back(Host.cycles() + _AckCycles);
+            break;
+        case DECODE_CMD_ACK:
+            stats.CmdAcks++;
+            if(_CreditPending)
+            {
+                _CreditPending = false;
+                _CreditActive = _CreditWindow > 0;
+                _Consumed = 0;
+                _CreditDue.clear();
+            }
+            else if(_HeaderPending)
+            {
+                _HeaderPending = false;
+                _HeaderTags = _HeaderEnable;
+            }
+            else if(_CRCPending)
+            {
+                _CRCPending = false;
+                _CRCAcked = true;
+            }
+            break;
+        case DECODE_ERROR:
+            stats.Errors++;
+            break;
+    }
+}
+
+void ArduEyeUISim::poll()
+{
+    while(!_AckDue.empty() && Host.cycles() >= _AckDue.front())
+    {
+        Host.pushRx(ESC_CHAR);
+        Host.pushRx(ACK_CHAR);
+        _AckDue.erase(_AckDue.begin());
+    }
+    while(!_CreditDue.empty() && Host.cycles() >= _CreditDue.front())
+    {
+        Host.pushRx(ESC_CHAR);
+        Host.pushRx(CREDIT_CHAR);
+        stats.Credits++;
+        _CreditDue.erase(_CreditDue.begin());
+    }
+}
@@ -0,0 +1,266 @@
+/*
+  ArduEyeSim.h - host simulation of the ArduEye ARM firmware and the UI
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ ArduEyeSim plays the sensor side of the SPI protocol described in
+ ArduEye.h / ArmSensor.h on the host backend: it answers SOH_CHAR header
+ requests, streams SOD_CHAR payloads, executes commands and raises the
+ data ready line once per frame at the configured frame rate.
+ 
+ ArduEyeDecoder decodes the ESC_CHAR framed serial stream sent by the
+ library one byte at a time, so tests can check what reached the UI.
+ 
+ ArduEyeUISim plays the UI side of the serial link: it decodes the
+ ESC_CHAR framed packets, acknowledges GO_CHAR pings (or grants credit,
+ see enableCredit()) after a configurable latency, decodes (and
+ decompresses, see enableCompression()) dataset payloads and counts
+ packets, frames and payload bytes.  Packets tagged SOS_CHAR sensor_id
+ by an ArduEyeBus are kept apart per sensor.
+*/
+
+#ifndef ARDUEYE_SIM_H
+#define ARDUEYE_SIM_H
+
+#include <map>
+#include <vector>
+#include "ArduEyeHost.h"
+
+// largest raw image supported by the simulated vision chip
+#define SIM_MAX_RES 112
+
+// content of the simulated raw image
+#define SIM_SCENE_STATIC 0  // fixed gradient, identical every frame
+#define SIM_SCENE_MOVING 1  // gradient shifted by one pixel per frame
+#define SIM_SCENE_NOISE  2  // pseudo random pixels
+#define SIM_SCENE_ESC    3  // every pixel equal to ESC_CHAR
+
+class ArduEyeSim : public HostSpiDevice {
+public:
+    struct Stats {
+        unsigned long Frames;
+        unsigned long HeaderRequests;
+        unsigned long DataRequests;
+        // SOF_CHAR requests for several datasets
+        unsigned long FrameRequests;
+        // SOC_CHAR requests resuming a payload after a CRC error
+        unsigned long ResumeRequests;
+        // reply bytes corrupted by setNoise()
+        unsigned long CorruptBytes;
+        unsigned long Commands;
+        unsigned long PayloadBytes;
+        // cycles from data ready to END_FRAME
+        uint64_t LatencyCycles;
+        uint64_t MaxLatencyCycles;
+    };
+    
+    ArduEyeSim();
+    
+    // frame rate of the vision chip
+    void setFPS(unsigned int FPS);
+    void setScene(int Scene) { _Scene = Scene; }
+    void setResolution(int Rows, int Cols);
+    void setOFResolution(int Rows, int Cols);
+    // flip a bit in about one of every OneIn reply bytes (0 for a clean link)
+    void setNoise(unsigned long OneIn) { _Noise = OneIn; }
+    
+    int rows() const { return _Rows; }
+    int cols() const { return _Cols; }
+    int ofRows() const { return _OFRows; }
+    int ofCols() const { return _OFCols; }
+    // frame being captured or read (counts the END_FRAMEs that started a new capture)
+    unsigned long frame() const { return _Frame; }
+    
+    // dataset dimensions as reported in the header
+    void datasetSize(int DSID, int &Rows, int &Cols) const;
+    // value of byte Idx of dataset DSID in frame Frame
+    byte datasetByte(int DSID, unsigned long Frame, int Idx) const;
+    // frame of the last payload of dataset DSID sent (0 if none)
+    unsigned long dataFrame(int DSID) const;
+    // bytes of Data, a payload received by the UI, that differ from dataset DSID of frame 
+    // Frame, selecting the Rows x Cols window at (Row, Col) and every Step-th row and column
+    // in it as ArduEye::setROI does.  Bytes missing or extra count as different
+    unsigned long mismatches(int DSID, unsigned long Frame, const std::vector<byte> &Data,
+                             int Row = 0, int Col = 0, int Rows = 0, int Cols = 0, int Step = 1) const;
+    
+    Stats stats;
+    void resetStats();
+    
+    // HostSpiDevice
+    void select();
+    void deselect();
+    byte transfer(byte Out);
+    int dataReady();
+    uint64_t risingEdge();
+
+private:
+    void execute();
+    void prepareHeader(int DSID);
+    void prepareData(int DSID, int Offset = 0);
+    void prepareFrame(const byte *DSIDs, int Count);
+    // append the CRC trailer of _Out[Start..] (CMD_CRC)
+    void appendCRC(size_t Start);
+
+    int _Rows, _Cols, _OFRows, _OFCols;
+    int _Scene;
+    unsigned long _FPS;
+    // CRC trailer width (CMD_CRC), noise rate and generator
+    int _CRC;
+    unsigned long _Noise, _NoiseSeed;
+    
+    // spi parser state
+    bool _Esc, _InPacket, _ReadMode;
+    std::vector<byte> _Packet;
+    std::vector<byte> _Out;
+    size_t _OutIdx;
+    
+    // frame timing
+    unsigned long _Frame;
+    uint64_t _ReadyAt, _PrevReadyAt;
+    // frame of the last payload sent, by dataset ID
+    std::map<int, unsigned long> _DataFrames;
+};
+
+// events returned by ArduEyeDecoder::feed()
+#define DECODE_NONE     0   // byte consumed, nothing complete yet
+#define DECODE_PACKET   1   // a packet ended, see packet()
+#define DECODE_GO       2   // GO_CHAR ping
+#define DECODE_CMD_ACK  3   // command acknowledge
+#define DECODE_ERROR    4   // unexpected escape sequence or data outside a packet
+
+class ArduEyeDecoder {
+public:
+    ArduEyeDecoder();
+    void reset();
+    
+    // decode one byte of the serial stream, returns a DECODE_* event
+    int feed(byte Data);
+    
+    // unescaped content of the last complete packet
+    const std::vector<byte> &packet() const { return _Last; }
+    // true if the last packet is an end of frame packet
+    bool endFrame() const;
+    
+private:
+    bool _Esc, _InPacket;
+    std::vector<byte> _Packet, _Last;
+};
+
+class ArduEyeUISim : public HostSerialPeer {
+public:
+    struct Stats {
+        unsigned long Bytes;
+        unsigned long Packets;
+        unsigned long Frames;
+        unsigned long Pings;
+        unsigned long CmdAcks;
+        unsigned long Credits;
+        unsigned long Errors;
+        unsigned long Headers;
+        // packets dropped for a bad CRC trailer
+        unsigned long CRCErrors;
+        // dataset bytes after decompression
+        unsigned long PayloadBytes;
+    };
+    
+    ArduEyeUISim();
+    
+    // delay between receiving a GO_CHAR and the ACK_CHAR arriving
+    void setAckLatency(unsigned long Us) { _AckCycles = (uint64_t)Us * (F_CPU / 1000000); }
+    // stop answering pings and granting credit (simulates a full UI buffer or a closed port)
+    void setAckEnabled(bool Enable) { _AckEnabled = Enable; }
+    
+    // send a command packet (ESC START_PCKT data ESC END_PCKT) to the Arduino
+    void sendCommand(const byte *Data, int Size);
+    // switch the Arduino to credit flow control with a window of Window * CREDIT_UNIT
+    // bytes, then grant a CREDIT_CHAR for every CREDIT_UNIT bytes received (0 turns it off)
+    void enableCredit(int Window);
+    bool creditActive() const { return _CreditActive; }
+    // ask the Arduino to compress RAW and OF payloads, Mode is the highest COMPRESS_ mode accepted
+    void enableCompression(int Mode);
+    // ask the Arduino to send headers only when they change (HEADER_CMD)
+    void enableHeaderChange(bool Enable);
+    // ask the Arduino for a CRC trailer of Width bits on every packet (CRC_CMD), from the
+    // first frame boundary after the CMD_ACK
+    void enableCRC(int Width);
+    
+    // last header received for dataset DSID (of sensor Sensor of an ArduEyeBus, -1 untagged)
+    const std::vector<byte> &header(int DSID, int Sensor = -1) { return _Headers[key(DSID, Sensor)]; }
+    
+    // last payload received for dataset DSID, decompressed (without the cols and name of a text display)
+    const std::vector<byte> &dataset(int DSID, int Sensor = -1) { return _Data[key(DSID, Sensor)]; }
+    // data packets received for dataset DSID
+    unsigned long datasetPackets(int DSID, int Sensor = -1) { return _DataPackets[key(DSID, Sensor)]; }
+    // END_FRAME packets received from sensor Sensor
+    unsigned long sensorFrames(int Sensor) { return _SensorFrames[Sensor]; }
+    
+    Stats stats;
+    void resetStats();
+    
+    // payload of the last complete packet
+    const std::vector<byte> &lastPacket() const { return _Decoder.packet(); }
+    
+    // HostSerialPeer
+    void receive(byte Data);
+    void poll();
+    
+private:
+    void decodeData(const std::vector<byte> &Packet);
+    // map key of dataset DSID of a sensor
+    static int key(int DSID, int Sensor) { return DSID + 256 * (Sensor + 1); }
+    
+    ArduEyeDecoder _Decoder;
+    bool _AckEnabled;
+    // next packet is a data packet (packets alternate header, data)
+    bool _ExpectData;
+    // header packets start with SOH_CHAR: waiting for the CMD_ACK of HEADER_CMD, on
+    bool _HeaderPending, _HeaderTags, _HeaderEnable;
+    // packets end with a CRC trailer: waiting for the CMD_ACK of CRC_CMD, then for the END_FRAME
+    // packet after which the new width applies, width requested, width in use
+    bool _CRCPending, _CRCAcked;
+    int _CRCWidth, _CRC;
+    std::map<int, std::vector<byte> > _Headers;
+    int _Compression;
+    std::map<int, std::vector<byte> > _Data;
+    std::map<int, unsigned long> _DataPackets;
+    // sensor tag of the current packet (-1 if none), frames per sensor
+    int _Sensor;
+    std::map<int, unsigned long> _SensorFrames;
+    // credit mode: waiting for the CMD_ACK of CREDIT_CMD, active, bytes not yet credited
+    bool _CreditPending, _CreditActive;
+    int _CreditWindow;
+    unsigned long _Consumed;
+    uint64_t _AckCycles;
+    // times at which pending acks and credits arrive, oldest first
+    std::vector<uint64_t> _AckDue, _CreditDue;
+};
+
+#endif
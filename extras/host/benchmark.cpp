@@ -0,0 +1,381 @@
+/*
+  benchmark.cpp - host benchmark matrix of the ArduEye acquisition pipeline
+  with regression thresholds
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ Runs getData(), getDataSet(), sendCommand() and checkUIData() on the host
+ backend over a matrix of raw resolutions, active datasets, UI and serial
+ monitor modes and plain or ESC_CHAR payloads (SIM_SCENE_ESC), and prints
+ one CSV line per case with the core calls, bytes and simulated time the
+ library used per frame (or per command).  In UI mode the payloads the
+ UI receives are compared with the sensor's datasets after every frame,
+ and any difference is reported and fails the run.  Build from the library
+ directory with
+
+   g++ -DARDUEYE_HOST -I. -Iextras/host -o benchmark ArduEye.cpp \
+       ArduEyeBus.cpp ArduEyePlatform.cpp extras/host/ArduEyeHost.cpp \
+       extras/host/ArduEyeSim.cpp extras/host/benchmark.cpp
+
+ usage: benchmark [-n frames] [-t percent] [-c baseline.csv]
+   -n  frames measured per case (default 8, after 2 warm up frames)
+   -c  compare with a previous output: a case is reported as a regression
+       if any count or its simulated time grew by more than the tolerance,
+       and the exit status is 1
+   -t  tolerance of the comparison in percent (default 1)
+
+ extras/host/benchmark.csv holds the output of the current library, so
+ a change that adds calls, bytes or time per byte shows up with
+
+   ./benchmark -c extras/host/benchmark.csv
+
+ and the file is regenerated (./benchmark > extras/host/benchmark.csv)
+ when the change is intended.  Columns, per frame or command:
+   spi_calls, spi_bytes        SPI transfers and bytes
+   serial_calls, serial_bytes  Serial.write/print calls and bytes written
+   serial_reads                bytes read from the UI
+   pin_io                      digitalWrite/digitalRead calls
+   sim_us                      simulated time spent in the library calls
+   host_ns                     PC time spent in them (not compared)
+*/
+
+#include <ArduEye.h>
+#include "ArduEyeSim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// largest number of cases and columns of a baseline file
+#define BENCH_MAX_CASES     256
+#define BENCH_COLUMNS       8
+// columns compared with the baseline (all but host_ns)
+#define BENCH_CHECKED       7
+#define BENCH_NAME_SIZE     64
+// warm up frames before measuring (header cache, first requests)
+#define BENCH_WARMUP        2
+
+// library calls measured by a case
+#define BENCH_GETDATA       0
+#define BENCH_GETDATASET    1
+#define BENCH_SENDCOMMAND   2
+#define BENCH_CHECKUIDATA   3
+
+static const char *ColumnNames[BENCH_COLUMNS] = {
+    "spi_calls", "spi_bytes", "serial_calls", "serial_bytes", 
+    "serial_reads", "pin_io", "sim_us", "host_ns"
+};
+
+struct BenchCase {
+    char Name[BENCH_NAME_SIZE];
+    double Values[BENCH_COLUMNS];
+};
+
+static ArduEyeSim Sensor;
+static ArduEyeUISim UI;
+
+static double wallSeconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// board counters at the start of a measured call
+struct Snapshot {
+    HostBoard::Stats Stats;
+    uint64_t Cycles;
+    double Wall;
+};
+
+static void snapshot(Snapshot &Snap)
+{
+    Snap.Stats = Host.stats;
+    Snap.Cycles = Host.cycles();
+    Snap.Wall = wallSeconds();
+}
+
+// add what the board did since Snap to the case totals
+static void accumulate(const Snapshot &Snap, double *Values)
+{
+    Values[0] += Host.stats.SpiCalls - Snap.Stats.SpiCalls;
+    Values[1] += Host.stats.SpiBytes - Snap.Stats.SpiBytes;
+    Values[2] += Host.stats.SerialCalls - Snap.Stats.SerialCalls;
+    Values[3] += Host.stats.SerialBytes - Snap.Stats.SerialBytes;
+    Values[4] += Host.stats.SerialReads - Snap.Stats.SerialReads;
+    Values[5] += (Host.stats.PinWrites - Snap.Stats.PinWrites) + (Host.stats.PinReads - Snap.Stats.PinReads);
+    Values[6] += (Host.cycles() - Snap.Cycles) / (F_CPU / 1e6);
+    Values[7] += (wallSeconds() - Snap.Wall) * 1e9;
+}
+
+/*
+ Acquire Frames frames with getData() (Api BENCH_GETDATA) or getDataSet()
+ for each dataset then endFrame() (BENCH_GETDATASET), counting only the
+ time inside those calls.  checkUIData() runs between frames to take the
+ UI acks, as in the examples, and is not counted.  In UI mode the payload
+ of each dataset received by the UI is checked after each frame
+ returns: the number of payloads that differ from the sensor's
+*/
+static unsigned long runFrames(BenchCase &Case, int Api, bool Monitor, const char *Sets, int NumSets, 
+                               unsigned long Frames)
+{
+    static char Buf[MAX_SPI_PCKT_SIZE];
+    ArduEye arduEye;
+    Snapshot Snap;
+    unsigned long Done = 0, Mismatches = 0;
+    int i;
+    
+    arduEye.begin(9, 10);
+    arduEye.enableSerialTx(true);
+    arduEye.setSerialMonitorMode(Monitor);
+    for(i = 0; i < NumSets; i++)
+        arduEye.startDataStream(Sets[i]);
+    
+    for(i = 0; i < BENCH_COLUMNS; i++)
+        Case.Values[i] = 0;
+    while(Done < Frames + BENCH_WARMUP)
+    {
+        if(arduEye.dataRdy())
+        {
+            snapshot(Snap);
+            if(Api == BENCH_GETDATA)
+                arduEye.getData();
+            else
+            {
+                for(i = 0; i < NumSets; i++)
+                    arduEye.getDataSet(Sets[i], Buf);
+                arduEye.endFrame();
+            }
+            if(++Done > BENCH_WARMUP)
+                accumulate(Snap, Case.Values);
+            for(i = 0; i < NumSets && !Monitor; i++)
+                if(Sensor.mismatches(Sets[i], Sensor.dataFrame(Sets[i]), UI.dataset(Sets[i])))
+                    Mismatches++;
+        }
+        arduEye.checkUIData();
+    }
+    for(i = 0; i < BENCH_COLUMNS; i++)
+        Case.Values[i] /= Frames;
+    return Mismatches;
+}
+
+/*
+ Send Count sensor commands with Value, either directly with sendCommand()
+ (BENCH_SENDCOMMAND) or as WRITE_CMD packets from the UI decoded by 
+ checkUIData() (BENCH_CHECKUIDATA, counting the checkUIData() calls until
+ the command is acknowledged)
+*/
+static void runCommands(BenchCase &Case, int Api, char Value, unsigned long Count)
+{
+    byte Cmd[3] = {WRITE_CMD, CMD_OF_SMOOTHING, (byte)Value};
+    ArduEye arduEye;
+    Snapshot Snap;
+    unsigned long n, Acks;
+    int i;
+    
+    arduEye.begin(9, 10);
+    arduEye.enableSerialTx(true);
+    
+    for(i = 0; i < BENCH_COLUMNS; i++)
+        Case.Values[i] = 0;
+    for(n = 0; n < Count; n++)
+    {
+        if(Api == BENCH_SENDCOMMAND)
+        {
+            snapshot(Snap);
+            arduEye.sendCommand(CMD_OF_SMOOTHING, &Value, 1);
+            accumulate(Snap, Case.Values);
+            continue;
+        }
+        Acks = UI.stats.CmdAcks;
+        UI.sendCommand(Cmd, sizeof(Cmd));
+        // the UI sends the packet once polled by the first call
+        while(UI.stats.CmdAcks == Acks)
+        {
+            snapshot(Snap);
+            arduEye.checkUIData();
+            accumulate(Snap, Case.Values);
+        }
+    }
+    for(i = 0; i < BENCH_COLUMNS; i++)
+        Case.Values[i] /= Count;
+}
+
+static void printCase(const BenchCase &Case)
+{
+    printf("%s", Case.Name);
+    for(int i = 0; i < BENCH_COLUMNS; i++)
+        printf(",%.2f", Case.Values[i]);
+    printf("\n");
+}
+
+// read a previous output, returns the number of cases (-1 if the file cannot be read)
+static int readBaseline(const char *File, BenchCase *Cases)
+{
+    char Line[512], *Field;
+    int i, NumCases = 0;
+    FILE *f = fopen(File, "r");
+    
+    if(!f)
+        return -1;
+    while(NumCases < BENCH_MAX_CASES && fgets(Line, sizeof(Line), f))
+    {
+        if(!strncmp(Line, "case,", 5))
+            continue;
+        Field = strtok(Line, ",\n");
+        if(!Field)
+            continue;
+        strncpy(Cases[NumCases].Name, Field, BENCH_NAME_SIZE - 1);
+        Cases[NumCases].Name[BENCH_NAME_SIZE - 1] = 0;
+        for(i = 0; i < BENCH_COLUMNS; i++)
+        {
+            Field = strtok(0, ",\n");
+            Cases[NumCases].Values[i] = Field ? atof(Field) : 0;
+        }
+        NumCases++;
+    }
+    fclose(f);
+    return NumCases;
+}
+
+// compare a case with the baseline, returns false (and reports it) if a column grew too much
+static bool checkCase(const BenchCase &Case, const BenchCase *Base, int NumBase, double Tolerance)
+{
+    bool Pass = true;
+    
+    for(int k = 0; k < NumBase; k++)
+    {
+        if(strcmp(Base[k].Name, Case.Name))
+            continue;
+        for(int i = 0; i < BENCH_CHECKED; i++)
+        {
+            // half the printed resolution of slack for rounding
+            if(Case.Values[i] > Base[k].Values[i] * (1 + Tolerance / 100) + 0.005)
+            {
+                fprintf(stderr, "regression %s %s: %.2f, baseline %.2f\n", Case.Name, 
+                        ColumnNames[i], Case.Values[i], Base[k].Values[i]);
+                Pass = false;
+            }
+        }
+        return Pass;
+    }
+    fprintf(stderr, "new case %s (not in the baseline)\n", Case.Name);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    // raw resolutions (optic flow at a quarter of it), dataset combinations and scenes
+    static const int Res[] = {8, 40, SIM_MAX_RES};
+    static const char SetList[][MAX_DATASETS] = {
+        {ARDUEYE_ID_OF},
+        {ARDUEYE_ID_RAW},
+        {ARDUEYE_ID_RAW, ARDUEYE_ID_OF, ARDUEYE_ID_FPS},
+        {ARDUEYE_ID_RAW, ARDUEYE_ID_OF, ARDUEYE_ID_FPS, ARDUEYE_ID_CMD, ARDUEYE_ID_MAXES}
+    };
+    static const int SetCount[] = {1, 1, 3, 5};
+    static const char *SetNames[] = {"of", "raw", "raw+of+fps", "all"};
+    static const char *ApiNames[] = {"getdata", "getdataset", "sendcommand", "checkuidata"};
+    static BenchCase Base[BENCH_MAX_CASES];
+    unsigned long Frames = 8;
+    double Tolerance = 1;
+    const char *BaseFile = 0;
+    int NumBase = 0, Failed = 0;
+    int i, Api, Mode, r, s, Scene;
+    unsigned long Mismatches;
+    BenchCase Case;
+    
+    for(i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            Frames = strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            Tolerance = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+            BaseFile = argv[++i];
+    }
+    if(Frames == 0)
+        Frames = 1;
+    if(BaseFile && (NumBase = readBaseline(BaseFile, Base)) < 0)
+    {
+        fprintf(stderr, "cannot read %s\n", BaseFile);
+        return 2;
+    }
+    
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.attachPeer(&UI);
+    // frames are ready as soon as the previous one is read
+    Sensor.setFPS(10000);
+    
+    printf("case");
+    for(i = 0; i < BENCH_COLUMNS; i++)
+        printf(",%s", ColumnNames[i]);
+    printf("\n");
+    
+    for(Api = BENCH_GETDATA; Api <= BENCH_GETDATASET; Api++)
+    for(Mode = 0; Mode < 2; Mode++)
+    for(r = 0; r < (int)(sizeof(Res) / sizeof(Res[0])); r++)
+    for(s = 0; s < (int)(sizeof(SetCount) / sizeof(SetCount[0])); s++)
+    for(Scene = SIM_SCENE_STATIC; Scene <= SIM_SCENE_ESC; Scene += SIM_SCENE_ESC - SIM_SCENE_STATIC)
+    {
+        // the scene only changes the raw image
+        if(Scene == SIM_SCENE_ESC && SetList[s][0] != ARDUEYE_ID_RAW)
+            continue;
+        Sensor.setResolution(Res[r], Res[r]);
+        Sensor.setOFResolution(Res[r] / 4, Res[r] / 4);
+        Sensor.setScene(Scene);
+        sprintf(Case.Name, "%s/%s/%dx%d/%s/%s", ApiNames[Api], Mode ? "monitor" : "ui", 
+                Res[r], Res[r], SetNames[s], Scene == SIM_SCENE_ESC ? "esc" : "plain");
+        Mismatches = runFrames(Case, Api, Mode != 0, SetList[s], SetCount[s], Frames);
+        printCase(Case);
+        if(Mismatches)
+        {
+            fprintf(stderr, "payload %s: %lu datasets differ from the sensor's\n", Case.Name, Mismatches);
+            Failed++;
+        }
+        if(BaseFile && !checkCase(Case, Base, NumBase, Tolerance))
+            Failed++;
+    }
+    
+    for(Api = BENCH_SENDCOMMAND; Api <= BENCH_CHECKUIDATA; Api++)
+    for(Scene = 0; Scene < 2; Scene++)
+    {
+        sprintf(Case.Name, "%s/%s", ApiNames[Api], Scene ? "esc" : "plain");
+        runCommands(Case, Api, Scene ? ESC_CHAR : 1, 16 * Frames);
+        printCase(Case);
+        if(BaseFile && !checkCase(Case, Base, NumBase, Tolerance))
+            Failed++;
+    }
+    
+    if(BaseFile || Failed)
+        fprintf(stderr, "%d regressions\n", Failed);
+    return Failed ? 1 : 0;
+}
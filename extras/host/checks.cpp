@@ -0,0 +1,669 @@
+/*
+  checks.cpp - functional checks of the ArduEye library on the host
+  backend
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ Runs the library against the simulated sensor and UI (or on known
+ input) and compares the results with the expected values.  Prints a
+ PASS or FAIL line per check and exits with the number of failed checks.
+ Build from the library directory with
+
+   g++ -DARDUEYE_HOST -I. -Iextras/host -o checks ArduEye.cpp \
+       ArduEyeBus.cpp ArduEyeFlow.cpp ArduEyeImage.cpp \
+       ArduEyePlatform.cpp extras/host/ArduEyeHost.cpp \
+       extras/host/ArduEyeSim.cpp extras/host/checks.cpp
+
+ usage: checks [name ...]
+   runs the named checks (default all):
+   flow   ArduEyeFlow smoothing, outlier rejection and odometry, and the
+          OF dataset of the embedded example
+   image  ArduEyeImage kernels, max and centroid on a known 112 x 112 image
+   cmd    UI commands received while poll() sends frames: every command
+          acknowledged, no decode error at the UI
+   crc    CRC_CMD changing the serial CRC width while poll() sends frames:
+          no packet fails the check at the UI
+   chunk  poll() with setChunkRequest: chip select high after every call,
+          payloads resumed from the right offset
+   shared two sensors started with begin() polled in turn: the payload one
+          of them forwards is not overwritten by the other's reads
+   bus    direct calls to a sensor of an ArduEyeBus while poll() holds
+          chip select for another: no read, the command held until the
+          read ends, the payload being read intact
+*/
+
+#include <ArduEye.h>
+#include <ArduEyeBus.h>
+#include <ArduEyeFlow.h>
+#include <ArduEyeImage.h>
+#include "ArduEyeSim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int Failed;
+
+// report one comparison
+static void expect(const char *Check, const char *What, long Value, long Expected, long Tolerance = 0)
+{
+    bool Ok = labs(Value - Expected) <= Tolerance;
+    
+    printf("%s %-6s %s: %ld (expected %ld)\n", Ok ? "PASS" : "FAIL", Check, What, Value, Expected);
+    if(!Ok)
+        Failed++;
+}
+
+// frame of Vectors OF vectors all equal to (X, Y)
+static void fillFlow(char *Data, int Vectors, int X, int Y)
+{
+    for(int i = 0; i < Vectors; i++)
+    {
+        Data[2*i] = X;
+        Data[2*i + 1] = Y;
+    }
+}
+
+/*---------------------------------------------------
+ checkFlow: ArduEyeFlow on known frames, then on the
+ OF dataset read as in ArduEyeInterface_Embedded
+ ---------------------------------------------------*/
+static void checkFlow()
+{
+    char Data[2*FLOW_MAX_VECTORS];
+    ArduEyeFlow flow;
+    int i;
+    
+    // plain mean, no smoothing
+    flow.setSmoothing(0);
+    for(i = 0; i < 4; i++)
+    {
+        Data[2*i] = 2 + 2*i;
+        Data[2*i + 1] = -3;
+    }
+    flow.update(Data, 8);
+    expect("flow", "mean x", flow.flowX(), 5 * FLOW_ONE);
+    expect("flow", "mean y", flow.flowY(), -3 * FLOW_ONE);
+    expect("flow", "inliers", flow.inliers(), 4);
+    
+    // IIR smoothing, over the full signed byte range
+    flow.reset();
+    flow.setSmoothing(1);
+    fillFlow(Data, 1, -128, 127);
+    flow.update(Data, 2);
+    fillFlow(Data, 1, 127, -128);
+    flow.update(Data, 2);
+    expect("flow", "smoothed x", flow.vectorX(0), (-128 + 127) * FLOW_ONE / 2);
+    expect("flow", "smoothed y", flow.vectorY(0), (127 - 128) * FLOW_ONE / 2);
+    
+    // one outlier in a full grid
+    flow.reset();
+    flow.setSmoothing(0);
+    flow.setOutlierLimit(8);
+    fillFlow(Data, FLOW_MAX_VECTORS, 10, -5);
+    Data[0] = 100;
+    Data[1] = 100;
+    flow.update(Data, sizeof(Data));
+    expect("flow", "inliers", flow.inliers(), FLOW_MAX_VECTORS - 1);
+    expect("flow", "outlier x", flow.flowX(), 10 * FLOW_ONE, 2);
+    expect("flow", "outlier y", flow.flowY(), -5 * FLOW_ONE, 2);
+    
+    // odometry
+    flow.reset();
+    flow.setOutlierLimit(0);
+    fillFlow(Data, FLOW_MAX_VECTORS, 3, -2);
+    for(i = 0; i < 10; i++)
+        flow.update(Data, sizeof(Data));
+    expect("flow", "odometry x", flow.odometryX(), 30);
+    expect("flow", "odometry y", flow.odometryY(), -20);
+    
+    // the sensor's OF dataset (8 x 16 bytes, 8 x 8 vectors of one pixel = 16 units to the right)
+    ArduEyeSim Sensor;
+    ArduEye arduEye;
+    int Size = 0, Rows, Cols;
+    
+    Sensor.setOFResolution(8, 8);
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.reset();
+    arduEye.begin(9, 10);
+    while(!arduEye.sensorRdy());
+    arduEye.startDataStream(ARDUEYE_ID_OF);
+    flow.reset();
+    flow.setSmoothing(2);
+    flow.setOutlierLimit(8);
+    for(i = 0; i < 10; )
+    {
+        if(arduEye.dataRdy())
+        {
+            Size = arduEye.getDataSet(ARDUEYE_ID_OF, Data, sizeof(Data), &Rows, &Cols);
+            if(Size > 0)
+                flow.update(Data, Size);
+            arduEye.endFrame();
+            i++;
+        }
+        arduEye.checkUIData();
+    }
+    expect("flow", "dataset size", Size, Sensor.ofRows() * Sensor.ofCols() * 2);
+    expect("flow", "dataset inliers", flow.inliers(), Sensor.ofRows() * Sensor.ofCols());
+    expect("flow", "dataset flow x", flow.flowX(), 16 * FLOW_ONE, 2);
+    expect("flow", "dataset odometry x", flow.odometryX(), 10 * 16, 1);
+}
+
+// known image: a 3 x 3 square of 255 centered on (40, 90), the rest 0
+#define IMG_SIZE 112
+static char Image[IMG_SIZE * IMG_SIZE];
+static int ImgKernel, ImgMismatches;
+
+static int pixel(int Row, int Col)
+{
+    Row = constrain(Row, 0, IMG_SIZE - 1);
+    Col = constrain(Col, 0, IMG_SIZE - 1);
+    return (unsigned char)Image[Row * IMG_SIZE + Col];
+}
+
+// filtered pixel computed directly from the kernel definitions
+static int reference(int Row, int Col)
+{
+    int r, c, Sum = 0, Gx, Gy;
+    
+    switch(ImgKernel)
+    {
+        case IMAGE_KERNEL_BOX:
+            for(r = -1; r <= 1; r++)
+                for(c = -1; c <= 1; c++)
+                    Sum += pixel(Row + r, Col + c);
+            return Sum / 9;
+        case IMAGE_KERNEL_GAUSS:
+            for(r = -1; r <= 1; r++)
+                for(c = -1; c <= 1; c++)
+                    Sum += pixel(Row + r, Col + c) << (2 - abs(r) - abs(c));
+            return Sum / 16;
+        case IMAGE_KERNEL_SOBEL:
+            Gx = Gy = 0;
+            for(r = -1; r <= 1; r++)
+            {
+                Gx += (pixel(Row + r, Col + 1) - pixel(Row + r, Col - 1)) << (1 - abs(r));
+                Gy += (pixel(Row + 1, Col + r) - pixel(Row - 1, Col + r)) << (1 - abs(r));
+            }
+            return constrain((abs(Gx) + abs(Gy)) / 8, 0, 255);
+        default:
+            return pixel(Row, Col);
+    }
+}
+
+// row handler: compare with the reference (the box blur divides by 9 approximately)
+static void compareRow(int Row, unsigned char *Data, int Cols)
+{
+    int Tolerance = ImgKernel == IMAGE_KERNEL_BOX ? 1 : 0;
+    
+    if(Cols != IMG_SIZE)
+        ImgMismatches++;
+    for(int c = 0; c < Cols; c++)
+        if(abs(Data[c] - reference(Row, c)) > Tolerance)
+            ImgMismatches++;
+}
+
+/*---------------------------------------------------
+ checkImage: ArduEyeImage on a known image, whole and
+ packet by packet
+ ---------------------------------------------------*/
+static void checkImage()
+{
+    static const struct {
+        const char *Name;
+        int Kernel;
+        int MaxValue, MaxRow, MaxCol;
+        int Count;
+    } Cases[] = {
+        {"none", IMAGE_KERNEL_NONE, 255, 39, 89, 9},
+        {"box", IMAGE_KERNEL_BOX, 255, 40, 90, 5},
+        {"gauss", IMAGE_KERNEL_GAUSS, 255, 40, 90, 9},
+        {"sobel", IMAGE_KERNEL_SOBEL, 191, 39, 89, 4},
+    };
+    ArduEyeImage image, packets;
+    char What[64];
+    int i, k, Row, Col;
+    
+    for(Row = 39; Row <= 41; Row++)
+        for(Col = 89; Col <= 91; Col++)
+            Image[Row * IMG_SIZE + Col] = (char)255;
+    
+    image.setThreshold(128);
+    image.setRowHandler(compareRow);
+    packets.setThreshold(128);
+    for(k = 0; k < (int)(sizeof(Cases) / sizeof(Cases[0])); k++)
+    {
+        ImgKernel = Cases[k].Kernel;
+        ImgMismatches = 0;
+        image.setKernel(ImgKernel);
+        image.processFrame(Image, IMG_SIZE, IMG_SIZE);
+        
+        sprintf(What, "%s mismatched pixels", Cases[k].Name);
+        expect("image", What, ImgMismatches, 0);
+        sprintf(What, "%s max", Cases[k].Name);
+        expect("image", What, image.maxValue(), Cases[k].MaxValue);
+        sprintf(What, "%s max row", Cases[k].Name);
+        expect("image", What, image.maxRow(), Cases[k].MaxRow);
+        sprintf(What, "%s max col", Cases[k].Name);
+        expect("image", What, image.maxCol(), Cases[k].MaxCol);
+        sprintf(What, "%s count", Cases[k].Name);
+        expect("image", What, image.count(), Cases[k].Count);
+        // the features are symmetric about the center of the square
+        if(Cases[k].Count > 0)
+        {
+            sprintf(What, "%s centroid row", Cases[k].Name);
+            expect("image", What, image.centroidRow(), 40 * 256);
+            sprintf(What, "%s centroid col", Cases[k].Name);
+            expect("image", What, image.centroidCol(), 90 * 256);
+        }
+        
+        // same frame in 50 pixel packets, as from a DataSetHandler
+        packets.setKernel(ImgKernel);
+        packets.setSize(IMG_SIZE, IMG_SIZE);
+        for(i = 0; i < IMG_SIZE * IMG_SIZE; i += 50)
+            packets.push(Image + i, constrain(IMG_SIZE * IMG_SIZE - i, 0, 50), i / IMG_SIZE, i % IMG_SIZE);
+        sprintf(What, "%s packets done", Cases[k].Name);
+        expect("image", What, packets.done(), 1);
+        sprintf(What, "%s packets max", Cases[k].Name);
+        expect("image", What, packets.maxValue() * 1000000L + packets.maxRow() * 1000 + packets.maxCol(),
+               image.maxValue() * 1000000L + image.maxRow() * 1000 + image.maxCol());
+        sprintf(What, "%s packets centroid", Cases[k].Name);
+        expect("image", What, packets.centroidRow() * 100000L + packets.centroidCol(),
+               image.centroidRow() * 100000L + image.centroidCol());
+    }
+    expect("image", "cropped", image.cropped(), 0);
+    image.setRowHandler(0);
+    image.processFrame(Image, 1, IMAGE_MAX_COLS + 1);
+    expect("image", "cropped wide frame", image.cropped(), 1);
+}
+
+/*---------------------------------------------------
+ checkCommands: the UI sends SERIAL_START every 2 ms while
+ poll() forwards RAW frames, with payloads full of ESC_CHAR
+ or noise, with pings or credit.  The CMD_ACKs must not
+ break the packets being sent
+ ---------------------------------------------------*/
+static void checkCommands()
+{
+    static const struct {
+        const char *Name;
+        int Scene;
+        int Credit;
+    } Cases[] = {
+        {"noise", SIM_SCENE_NOISE, 0},
+        {"esc", SIM_SCENE_ESC, 0},
+        {"esc credit", SIM_SCENE_ESC, 8},
+    };
+    const unsigned long Frames = 50;
+    const byte Cmd[2] = {SERIAL_START, 1};
+    char What[64];
+    
+    for(int k = 0; k < (int)(sizeof(Cases) / sizeof(Cases[0])); k++)
+    {
+        ArduEyeSim Sensor;
+        ArduEyeUISim UI;
+        ArduEye arduEye;
+        unsigned long Sent = 0;
+        uint64_t Next = 0;
+        
+        Sensor.setScene(Cases[k].Scene);
+        Sensor.setResolution(32, 32);
+        Host.attachDevice(&Sensor, 10, 9);
+        Host.attachPeer(&UI);
+        Host.reset();
+        arduEye.begin(9, 10);
+        arduEye.enableSerialTx(true);
+        while(!arduEye.sensorRdy());
+        arduEye.startDataStream(ARDUEYE_ID_RAW);
+        if(Cases[k].Credit)
+        {
+            UI.enableCredit(Cases[k].Credit);
+            while(!UI.creditActive())
+                arduEye.checkUIData();
+        }
+        Sensor.resetStats();
+        UI.resetStats();
+        
+        while(Sensor.stats.Frames < Frames)
+        {
+            if(Host.cycles() >= Next)
+            {
+                UI.sendCommand(Cmd, sizeof(Cmd));
+                Sent++;
+                Next = Host.cycles() + 2000 * (F_CPU / 1000000);
+            }
+            arduEye.poll();
+            arduEye.checkUIData();
+        }
+        // finish the last frame and send the acks still held
+        while(arduEye.frameActive() || UI.stats.CmdAcks < Sent)
+        {
+            arduEye.poll();
+            arduEye.checkUIData();
+            if(Host.cycles() > Next + F_CPU)
+                break;
+        }
+        
+        sprintf(What, "%s decode errors", Cases[k].Name);
+        expect("cmd", What, UI.stats.Errors, 0);
+        sprintf(What, "%s acks", Cases[k].Name);
+        expect("cmd", What, UI.stats.CmdAcks, Sent);
+        sprintf(What, "%s frames", Cases[k].Name);
+        expect("cmd", What, UI.stats.Frames, Sensor.stats.Frames);
+    }
+}
+
+/*---------------------------------------------------
+ checkCRCSwitch: the UI asks for 16, 32 and no CRC bits in
+ the middle of poll() frames.  Both sides must switch at
+ the same frame boundary
+ ---------------------------------------------------*/
+static void checkCRCSwitch()
+{
+    static const int Widths[] = {CRC_16, CRC_32, CRC_NONE, CRC_32};
+    const unsigned long Frames = 10;
+    ArduEyeSim Sensor;
+    ArduEyeUISim UI;
+    ArduEye arduEye;
+    int i;
+    
+    Sensor.setScene(SIM_SCENE_NOISE);
+    Sensor.setResolution(32, 32);
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.attachPeer(&UI);
+    Host.reset();
+    arduEye.begin(9, 10);
+    arduEye.enableSerialTx(true);
+    while(!arduEye.sensorRdy());
+    arduEye.startDataStream(ARDUEYE_ID_RAW);
+    Sensor.resetStats();
+    UI.resetStats();
+    
+    for(i = 0; i < (int)(sizeof(Widths) / sizeof(Widths[0])); i++)
+    {
+        // a few frames, then the command in the middle of the payload of a frame
+        while(Sensor.stats.Frames < Frames * (i + 1) || !arduEye.frameActive())
+        {
+            arduEye.poll();
+            arduEye.checkUIData();
+        }
+        for(int k = 0; k < 40; k++)
+            arduEye.poll();
+        UI.enableCRC(Widths[i]);
+    }
+    while(Sensor.stats.Frames < Frames * (i + 1) || arduEye.frameActive())
+    {
+        arduEye.poll();
+        arduEye.checkUIData();
+    }
+    
+    expect("crc", "ui crc errors", UI.stats.CRCErrors, 0);
+    expect("crc", "decode errors", UI.stats.Errors, 0);
+    expect("crc", "frames", UI.stats.Frames, Sensor.stats.Frames, 1);
+    // the last END_FRAME packet has a 32 bit trailer
+    expect("crc", "end frame packet bytes", UI.lastPacket().size(), 1 + 4);
+}
+
+/*---------------------------------------------------
+ checkChunkRequest: poll() forwards RAW frames, reading each
+ chunk with its own request, with and without a frame 
+ buffer.  Chip select must be high whenever poll() returns
+ and the UI must get the payload of the frame that was read
+ ---------------------------------------------------*/
+static void checkChunkRequest()
+{
+    static char FrameBuf[FULL_HEAD_SIZE + 32 * 32];
+    const unsigned long Frames = 10;
+    char What[64];
+    
+    for(int Buffered = 0; Buffered < 2; Buffered++)
+    {
+        ArduEyeSim Sensor;
+        ArduEyeUISim UI;
+        ArduEye arduEye;
+        unsigned long Frame = 0, Compared = 0, Mismatches = 0, Held = 0;
+        int i;
+        
+        Sensor.setScene(SIM_SCENE_NOISE);
+        Sensor.setResolution(32, 32);
+        Host.attachDevice(&Sensor, 10, 9);
+        Host.attachPeer(&UI);
+        Host.reset();
+        arduEye.begin(9, 10);
+        arduEye.enableSerialTx(true);
+        arduEye.setChunkRequest(true);
+        if(Buffered)
+            arduEye.setFrameBuffer(FrameBuf, sizeof(FrameBuf));
+        while(!arduEye.sensorRdy());
+        arduEye.startDataStream(ARDUEYE_ID_RAW);
+        Sensor.resetStats();
+        
+        while(Compared < Frames)
+        {
+            boolean Active = arduEye.frameActive();
+            
+            if(arduEye.poll())
+            {
+                const std::vector<byte> &Data = UI.dataset(ARDUEYE_ID_RAW);
+                
+                if(Data.size() != 32 * 32)
+                    Mismatches++;
+                for(i = 0; i < (int)Data.size(); i++)
+                    if(Data[i] != Sensor.datasetByte(ARDUEYE_ID_RAW, Frame, i))
+                    {
+                        Mismatches++;
+                        break;
+                    }
+                Compared++;
+            }
+            else if(!Active && arduEye.frameActive())
+                Frame = Sensor.frame();
+            if(digitalRead(10) == LOW)
+                Held++;
+            arduEye.checkUIData();
+        }
+        
+        sprintf(What, "%s chip select low after poll()", Buffered ? "buffered" : "direct");
+        expect("chunk", What, Held, 0);
+        sprintf(What, "%s frames with a wrong payload", Buffered ? "buffered" : "direct");
+        expect("chunk", What, Mismatches, 0);
+        // 16 chunks per frame, all but the first resumed
+        sprintf(What, "%s resume requests", Buffered ? "buffered" : "direct");
+        expect("chunk", What, Sensor.stats.ResumeRequests, 15 * Sensor.stats.DataRequests);
+    }
+}
+
+/*---------------------------------------------------
+ checkSharedBuffer: two sensors started with begin() share
+ the SPI receive buffer.  The first forwards RAW frames to 
+ the UI with poll() while the second reads its frames with
+ poll() in between (both with chunk requests), the payload 
+ staged by the first must not change before it is sent
+ ---------------------------------------------------*/
+static void checkSharedBuffer()
+{
+    const unsigned long Frames = 10;
+    ArduEyeSim Sensor, Other;
+    ArduEyeUISim UI;
+    ArduEye arduEye, otherEye;
+    unsigned long Frame = 0, Compared = 0, Mismatches = 0;
+    int i;
+    
+    Sensor.setScene(SIM_SCENE_NOISE);
+    Sensor.setResolution(32, 32);
+    Other.setScene(SIM_SCENE_ESC);
+    Other.setResolution(32, 32);
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.attachDevice(&Other, 8, 7);
+    Host.attachPeer(&UI);
+    Host.reset();
+    arduEye.begin(9, 10);
+    otherEye.begin(7, 8);
+    arduEye.enableSerialTx(true);
+    // chip select is raised after each call, so the sensors can take turns
+    arduEye.setChunkRequest(true);
+    otherEye.setChunkRequest(true);
+    while(!arduEye.sensorRdy());
+    while(!otherEye.sensorRdy());
+    arduEye.startDataStream(ARDUEYE_ID_RAW);
+    otherEye.startDataStream(ARDUEYE_ID_RAW);
+    
+    while(Compared < Frames)
+    {
+        boolean Active = arduEye.frameActive();
+        
+        if(arduEye.poll())
+        {
+            const std::vector<byte> &Data = UI.dataset(ARDUEYE_ID_RAW);
+            
+            if(Data.size() != 32 * 32)
+                Mismatches++;
+            for(i = 0; i < (int)Data.size(); i++)
+                if(Data[i] != Sensor.datasetByte(ARDUEYE_ID_RAW, Frame, i))
+                {
+                    Mismatches++;
+                    break;
+                }
+            Compared++;
+        }
+        else if(!Active && arduEye.frameActive())
+            Frame = Sensor.frame();
+        arduEye.checkUIData();
+        otherEye.poll();
+    }
+    
+    expect("shared", "frames with a wrong payload", Mismatches, 0);
+    expect("shared", "frames read by the other sensor", Other.stats.Frames >= Frames, 1);
+}
+
+/*---------------------------------------------------
+ checkBusCalls: an ArduEyeBus polls RAW frames of two 
+ sensors.  In the middle of each payload of the first one,
+ the sketch asks the second for a dataset and changes its
+ resolution.  The read must be refused and the command held
+ until chip select is raised, the payload must be intact
+ ---------------------------------------------------*/
+static void checkBusCalls()
+{
+    const unsigned long Frames = 10;
+    ArduEyeSim Sensor, Other;
+    ArduEyeUISim UI;
+    ArduEye arduEye, otherEye;
+    ArduEyeBus Bus;
+    char Buf[32 * 32];
+    unsigned long Frame = 0, Compared = 0, Mismatches = 0, Refused = 0, Early = 0;
+    int i, Rows, Cols;
+    
+    Sensor.setScene(SIM_SCENE_NOISE);
+    Sensor.setResolution(32, 32);
+    Other.setScene(SIM_SCENE_ESC);
+    Other.setResolution(32, 32);
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.attachDevice(&Other, 8, 7);
+    Host.attachPeer(&UI);
+    Host.reset();
+    Bus.attach(arduEye, 9, 10);
+    Bus.attach(otherEye, 7, 8);
+    Bus.begin();
+    Bus.enableSerialTx(true);
+    while(!arduEye.sensorRdy());
+    while(!otherEye.sensorRdy());
+    arduEye.startDataStream(ARDUEYE_ID_RAW);
+    
+    // a corrupt read can stop the frames, give up after 10 s
+    while(Compared < Frames && Host.cycles() < 10 * (uint64_t)F_CPU)
+    {
+        boolean Active = arduEye.frameActive();
+        
+        if(Bus.poll() == 0)
+        {
+            const std::vector<byte> &Data = UI.dataset(ARDUEYE_ID_RAW, 0);
+            
+            if(Data.size() != 32 * 32)
+                Mismatches++;
+            for(i = 0; i < (int)Data.size(); i++)
+                if(Data[i] != Sensor.datasetByte(ARDUEYE_ID_RAW, Frame, i))
+                {
+                    Mismatches++;
+                    break;
+                }
+            Compared++;
+        }
+        else if(!Active && arduEye.frameActive())
+            Frame = Sensor.frame();
+        
+        // the first sensor's payload is being read
+        if(digitalRead(10) == LOW && Refused < Compared + 1)
+        {
+            if(otherEye.getDataSet(ARDUEYE_ID_RAW, Buf, sizeof(Buf), &Rows, &Cols) == 0 && Rows == 0)
+                Refused++;
+            otherEye.setResolution(16 + Compared % 2, 16);
+            if(Other.rows() == 16 + (int)(Compared % 2))
+                Early++;
+        }
+        Bus.checkUIData();
+    }
+    
+    expect("bus", "reads refused", Refused, Frames);
+    expect("bus", "commands sent during a read", Early, 0);
+    expect("bus", "commands sent after it", Other.rows(), 16 + (Frames - 1) % 2);
+    expect("bus", "frames with a wrong payload", Mismatches, 0);
+}
+
+static const struct {
+    const char *Name;
+    void (*Run)();
+} Checks[] = {
+    {"flow", checkFlow},
+    {"image", checkImage},
+    {"cmd", checkCommands},
+    {"crc", checkCRCSwitch},
+    {"chunk", checkChunkRequest},
+    {"shared", checkSharedBuffer},
+    {"bus", checkBusCalls},
+};
+
+int main(int argc, char **argv)
+{
+    unsigned int c;
+    int i;
+    
+    for(c = 0; c < sizeof(Checks) / sizeof(Checks[0]); c++)
+    {
+        bool Run = argc < 2;
+        for(i = 1; i < argc; i++)
+            if(!strcmp(argv[i], Checks[c].Name))
+                Run = true;
+        if(Run)
+            Checks[c].Run();
+    }
+    printf("%d failed\n", Failed);
+    return Failed;
+}
@@ -0,0 +1,363 @@
+/*
+  throughput.cpp - end to end throughput of the ArduEye library against
+  the simulated sensor and UI
+  Centeye, Inc
+  
+ ===============================================================================
+ Copyright (c) 2011, Centeye, Inc.
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+ * Redistributions of source code must retain the above copyright
+ notice, this list of conditions and the following disclaimer.
+ * Redistributions in binary form must reproduce the above copyright
+ notice, this list of conditions and the following disclaimer in the
+ documentation and/or other materials provided with the distribution.
+ * Neither the name of Centeye, Inc. nor the
+ names of its contributors may be used to endorse or promote products
+ derived from this software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL CENTEYE, INC. BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ===============================================================================
+*/
+
+/*
+ Runs the ArduEyeInterface example loop for a number of frames on the
+ host backend and reports the simulated frame rate, link throughput and
+ frame latency.  In UI mode every payload the UI receives (decompressed,
+ RAW after the -w selection) is compared with the sensor's dataset, and
+ the exit status is 1 if any differs.  Build from the library directory
+ with
+
+   g++ -DARDUEYE_HOST -I. -Iextras/host -o throughput ArduEye.cpp \
+       ArduEyeBus.cpp ArduEyePlatform.cpp extras/host/ArduEyeHost.cpp \
+       extras/host/ArduEyeSim.cpp extras/host/throughput.cpp
+
+ usage: throughput [-n frames] [-f fps] [-r rows cols] [-o ofrows ofcols]
+                   [-s scene] [-b baud] [-d spidiv] [-c window] [-z mode]
+                   [-w row col rows cols step] [-e dsid divisor priority]
+                   [-g budget] [-v width] [-l n] [-x] [-k] [-u] [-m] [-q] [-p] [-i] [-t]
+                   [dsid ...]
+   -b  serial baud rate (default 115200)
+   -d  SPI clock divider 2, 4, 8, 16, 32, 64 or 128 (default 8)
+   -c  credit flow control with a window of window * CREDIT_UNIT bytes
+       instead of GO_CHAR/ACK_CHAR pings
+   -z  compress RAW and OF payloads, mode 1 (COMPRESS_DELTA) or 2 
+       (COMPRESS_FRAME, with reference buffers for both datasets)
+   -w  send only a window of RAW to the UI, every step-th pixel (ROI_CMD)
+   -e  read dataset dsid every divisor frames with priority (RATE_CMD),
+       can be repeated
+   -g  limit the dataset bytes sent per frame
+   -v  CRC trailers of width 16 or 32 bits on SPI replies (CMD_CRC) and 
+       serial packets (CRC_CMD)
+   -l  SPI line noise: flip a bit in about one of every n reply bytes
+   -x  read each frame with a single SOF_CHAR request
+   -k  send headers to the UI only when they change (HEADER_CMD)
+   -u  read each frame into a frame buffer and end the frame before 
+       forwarding it
+   -m  serial monitor mode instead of UI mode
+   -p  use poll() instead of dataRdy()/getData()
+   -i  data ready interrupt mode
+   -q  serial transmit off (pure embedded acquisition)
+   -t  run linkTest() on the first dataset before streaming
+   dsid defaults to ARDUEYE_ID_OF
+
+ Built with -DARDUEYE_PROFILE it also prints the library's performance
+ counters (see ArduEye::getProfile): time per frame split into SPI header
+ and payload reads, serial forwarding and waits for the UI, for the frame
+ and for each dataset.  ARDUEYE_ID_PROFILE (60) can be streamed as a dsid
+*/
+
+#include <ArduEye.h>
+#include "ArduEyeSim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double wallSeconds()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// SPI_CLOCK_DIVx setting for a clock divider
+static int spiDivider(int Div)
+{
+    switch(Div)
+    {
+        case 2:   return SPI_CLOCK_DIV2;
+        case 4:   return SPI_CLOCK_DIV4;
+        case 16:  return SPI_CLOCK_DIV16;
+        case 32:  return SPI_CLOCK_DIV32;
+        case 64:  return SPI_CLOCK_DIV64;
+        case 128: return SPI_CLOCK_DIV128;
+        default:  return SPI_CLOCK_DIV8;
+    }
+}
+
+#ifdef ARDUEYE_PROFILE
+// performance counters of DataSet (ARDUEYE_ID_PROFILE for frames), times per frame or read
+static void printProfile(ArduEye &arduEye, char DataSet, const char *Name)
+{
+    double Count = arduEye.getProfile(DataSet, PROF_COUNT);
+    
+    if(Count == 0)
+        return;
+    printf("profile %-11s %.0f reads, us/read: frame %.1f header %.1f payload %.1f serial %.1f wait %.1f\n",
+           Name, Count, arduEye.getProfile(DataSet, PROF_FRAME_US) / Count,
+           arduEye.getProfile(DataSet, PROF_HEADER_US) / Count, arduEye.getProfile(DataSet, PROF_PAYLOAD_US) / Count,
+           arduEye.getProfile(DataSet, PROF_SERIAL_US) / Count, arduEye.getProfile(DataSet, PROF_WAIT_US) / Count);
+    printf("profile %-11s bytes/read: spi %.1f serial %.1f, dropped %lu, ack timeouts %lu\n", Name,
+           arduEye.getProfile(DataSet, PROF_SPI_BYTES) / Count, arduEye.getProfile(DataSet, PROF_SERIAL_BYTES) / Count,
+           arduEye.getProfile(DataSet, PROF_DROPPED), arduEye.getProfile(DataSet, PROF_ACK_TIMEOUTS));
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    unsigned long Frames = 10000;
+    int i, NumSets = 0, CreditWindow = 0, Compression = COMPRESS_NONE;
+    static char RawRef[SIM_MAX_RES * SIM_MAX_RES], OFRef[SIM_MAX_RES * SIM_MAX_RES];
+    static char FrameBuf[MAX_DATASETS * (FULL_HEAD_SIZE + SIM_MAX_RES * SIM_MAX_RES)];
+    byte ROICmd[7] = {ROI_CMD, ARDUEYE_ID_RAW, 0, 0, 0, 0, 1};
+    bool ROI = false;
+    byte RateCmd[MAX_DATASETS][4];
+    int NumRates = 0;
+    unsigned int Budget = 0;
+    int CRCWidth = CRC_NONE;
+    char Sets[MAX_DATASETS];
+    unsigned long Checked[MAX_DATASETS], Payloads = 0, Mismatches = 0;
+    bool MonitorMode = false, SerialTx = true, Poll = false, Interrupt = false, LinkTest = false;
+    bool FrameRequest = false, HeaderChange = false, Buffered = false;
+    ArduEyeConfig Config;
+    ArduEyeSim Sensor;
+    ArduEyeUISim UI;
+    ArduEye arduEye;
+    
+    for(i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+            Frames = strtoul(argv[++i], 0, 10);
+        else if(!strcmp(argv[i], "-f") && i + 1 < argc)
+            Sensor.setFPS(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "-r") && i + 2 < argc)
+        {
+            Sensor.setResolution(atoi(argv[i + 1]), atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if(!strcmp(argv[i], "-o") && i + 2 < argc)
+        {
+            Sensor.setOFResolution(atoi(argv[i + 1]), atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+            Sensor.setScene(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "-b") && i + 1 < argc)
+            Config.Baud = atol(argv[++i]);
+        else if(!strcmp(argv[i], "-d") && i + 1 < argc)
+            Config.SPIDivider = spiDivider(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+            CreditWindow = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-z") && i + 1 < argc)
+            Compression = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-w") && i + 5 < argc)
+        {
+            for(int k = 0; k < 5; k++)
+                ROICmd[2 + k] = atoi(argv[i + 1 + k]);
+            ROI = true;
+            i += 5;
+        }
+        else if(!strcmp(argv[i], "-e") && i + 3 < argc && NumRates < MAX_DATASETS)
+        {
+            RateCmd[NumRates][0] = RATE_CMD;
+            for(int k = 0; k < 3; k++)
+                RateCmd[NumRates][1 + k] = atoi(argv[i + 1 + k]);
+            NumRates++;
+            i += 3;
+        }
+        else if(!strcmp(argv[i], "-g") && i + 1 < argc)
+            Budget = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-v") && i + 1 < argc)
+            CRCWidth = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-l") && i + 1 < argc)
+            Sensor.setNoise(strtoul(argv[++i], 0, 10));
+        else if(!strcmp(argv[i], "-u"))
+            Buffered = true;
+        else if(!strcmp(argv[i], "-k"))
+            HeaderChange = true;
+        else if(!strcmp(argv[i], "-x"))
+            FrameRequest = true;
+        else if(!strcmp(argv[i], "-t"))
+            LinkTest = true;
+        else if(!strcmp(argv[i], "-m"))
+            MonitorMode = true;
+        else if(!strcmp(argv[i], "-q"))
+            SerialTx = false;
+        else if(!strcmp(argv[i], "-p"))
+            Poll = true;
+        else if(!strcmp(argv[i], "-i"))
+            Interrupt = true;
+        else if(NumSets < MAX_DATASETS)
+            Sets[NumSets++] = atoi(argv[i]);
+    }
+    if(NumSets == 0)
+        Sets[NumSets++] = ARDUEYE_ID_OF;
+    
+    Host.attachDevice(&Sensor, 10, 9);
+    Host.attachPeer(&UI);
+    
+    arduEye.begin(9, 10, Config);
+    arduEye.enableSerialTx(SerialTx);
+    arduEye.setSerialMonitorMode(MonitorMode);
+    arduEye.setFrameRequest(FrameRequest);
+    if(Buffered)
+        arduEye.setFrameBuffer(FrameBuf, sizeof(FrameBuf));
+    while(!arduEye.sensorRdy());
+    if(CRCWidth != CRC_NONE)
+        arduEye.setCRC(CRCWidth);
+    for(i = 0; i < NumSets; i++)
+        arduEye.startDataStream(Sets[i]);
+    if(LinkTest)
+    {
+        unsigned long SpiRate, SerialRate;
+        bool Ok = arduEye.linkTest(Sets[0], &SpiRate, &SerialRate);
+        printf("link test         %s spi %lu bytes/sec, serial %lu bytes/sec\n", 
+               Ok ? "ok" : "FAILED", SpiRate, SerialRate);
+    }
+    if(Interrupt)
+        arduEye.enableDataRdyInterrupt(true);
+    if(Compression != COMPRESS_NONE && SerialTx && !MonitorMode)
+    {
+        arduEye.setReferenceBuffer(ARDUEYE_ID_RAW, RawRef, sizeof(RawRef));
+        arduEye.setReferenceBuffer(ARDUEYE_ID_OF, OFRef, sizeof(OFRef));
+        UI.enableCompression(Compression);
+        while(UI.stats.CmdAcks == 0)
+            arduEye.checkUIData();
+    }
+    if(ROI && SerialTx)
+    {
+        unsigned long Acks = UI.stats.CmdAcks;
+        UI.sendCommand(ROICmd, sizeof(ROICmd));
+        while(UI.stats.CmdAcks == Acks)
+            arduEye.checkUIData();
+    }
+    for(i = 0; i < NumRates; i++)
+    {
+        unsigned long Acks = UI.stats.CmdAcks;
+        UI.sendCommand(RateCmd[i], 4);
+        while(SerialTx && UI.stats.CmdAcks == Acks)
+            arduEye.checkUIData();
+    }
+    arduEye.setFrameBudget(Budget);
+    if(HeaderChange && SerialTx && !MonitorMode)
+    {
+        unsigned long Acks = UI.stats.CmdAcks;
+        UI.enableHeaderChange(true);
+        while(UI.stats.CmdAcks == Acks)
+            arduEye.checkUIData();
+    }
+    if(CRCWidth != CRC_NONE && SerialTx && !MonitorMode)
+    {
+        unsigned long Acks = UI.stats.CmdAcks;
+        UI.enableCRC(CRCWidth);
+        while(UI.stats.CmdAcks == Acks)
+            arduEye.checkUIData();
+    }
+    if(CreditWindow > 0 && SerialTx && !MonitorMode)
+    {
+        UI.enableCredit(CreditWindow);
+        while(!UI.creditActive())
+            arduEye.checkUIData();
+    }
+    
+    // measure from the first frame on
+    Host.reset();
+    Sensor.resetStats();
+    UI.resetStats();
+    for(i = 0; i < NumSets; i++)
+        Checked[i] = UI.datasetPackets(Sets[i]);
+    
+    uint64_t LoopStart, MaxLoop = 0;
+    double Wall = wallSeconds();
+    while(Sensor.stats.Frames < Frames)
+    {
+        LoopStart = Host.cycles();
+        if(Poll)
+            arduEye.poll();
+        else if(arduEye.dataRdy())
+            arduEye.getData();
+        arduEye.checkUIData();
+        if(Host.cycles() - LoopStart > MaxLoop)
+            MaxLoop = Host.cycles() - LoopStart;
+        
+        // payloads received since the last loop, the library makes ARDUEYE_ID_PROFILE
+        for(i = 0; i < NumSets && SerialTx && !MonitorMode; i++)
+        {
+            if(Sets[i] == ARDUEYE_ID_PROFILE || UI.datasetPackets(Sets[i]) == Checked[i])
+                continue;
+            Checked[i] = UI.datasetPackets(Sets[i]);
+            Payloads++;
+            if(ROI && Sets[i] == ROICmd[1] ?
+               Sensor.mismatches(Sets[i], Sensor.dataFrame(Sets[i]), UI.dataset(Sets[i]), 
+                                 ROICmd[2], ROICmd[3], ROICmd[4], ROICmd[5], ROICmd[6]) :
+               Sensor.mismatches(Sets[i], Sensor.dataFrame(Sets[i]), UI.dataset(Sets[i])))
+                Mismatches++;
+        }
+    }
+    Wall = wallSeconds() - Wall;
+    
+    double Seconds = (double)Host.cycles() / F_CPU;
+    double Latency = (double)Sensor.stats.LatencyCycles / Sensor.stats.Frames / (F_CPU / 1e6);
+    double MaxLatency = (double)Sensor.stats.MaxLatencyCycles / (F_CPU / 1e6);
+    
+    printf("frames            %lu\n", Sensor.stats.Frames);
+    printf("simulated time    %.3f s\n", Seconds);
+    printf("frames/sec        %.2f\n", Sensor.stats.Frames / Seconds);
+    printf("spi bytes/sec     %.0f\n", Host.stats.SpiBytes / Seconds);
+    printf("spi calls/frame   %.1f\n", (double)Host.stats.SpiCalls / Sensor.stats.Frames);
+    printf("spi requests/frame %.1f\n", (double)(Sensor.stats.HeaderRequests + Sensor.stats.DataRequests + 
+           Sensor.stats.FrameRequests) / Sensor.stats.Frames);
+    printf("serial bytes/sec  %.0f\n", Host.stats.SerialBytes / Seconds);
+    printf("serial calls/frame %.1f\n", (double)Host.stats.SerialCalls / Sensor.stats.Frames);
+    printf("ui frames         %lu\n", UI.stats.Frames);
+    printf("ui pings/credits  %lu/%lu\n", UI.stats.Pings, UI.stats.Credits);
+    printf("ui headers/frame  %.1f\n", (double)UI.stats.Headers / Sensor.stats.Frames);
+    printf("ui payload/sec    %.0f\n", UI.stats.PayloadBytes / Seconds);
+    if(SerialTx && !MonitorMode)
+        printf("ui payload errors %lu of %lu checked\n", Mismatches, Payloads);
+    if(CRCWidth != CRC_NONE || Sensor.stats.CorruptBytes)
+        printf("crc errors        spi %lu (resumes %lu, corrupt bytes %lu), ui %lu, decode %lu\n", 
+               arduEye.crcErrors(), Sensor.stats.ResumeRequests, Sensor.stats.CorruptBytes, 
+               UI.stats.CRCErrors, UI.stats.Errors);
+    for(i = 0; i < NumSets; i++)
+        printf("ui dataset %-3d    %.2f packets/sec\n", Sets[i], UI.datasetPackets(Sets[i]) / Seconds);
+    printf("latency mean      %.1f us\n", Latency);
+    printf("latency max       %.1f us\n", MaxLatency);
+    if(Interrupt)
+        printf("frame interval    %lu us (jitter %lu us)\n", arduEye.frameInterval(), arduEye.frameJitter());
+    printf("loop time max     %.1f us\n", MaxLoop / (F_CPU / 1e6));
+    printf("host time         %.3f s (%.0f frames/sec)\n", Wall, Sensor.stats.Frames / Wall);
+#ifdef ARDUEYE_PROFILE
+    printProfile(arduEye, ARDUEYE_ID_PROFILE, "frame");
+    for(i = 0; i < NumSets; i++)
+    {
+        char Name[16];
+        sprintf(Name, "dataset %d", Sets[i]);
+        if(Sets[i] != ARDUEYE_ID_PROFILE)
+            printProfile(arduEye, Sets[i], Name);
+    }
+#endif
+    return Mismatches ? 1 : 0;
+}